@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "arena.h"
+
+static bloop_arena *bloop_current_arena = NULL;
+
+#define bloop_align(n) (((n) + BLOOP_ARENA_ALIGN - 1) & ~((size_t)BLOOP_ARENA_ALIGN - 1))
+// The data of a chunk starts at the first aligned address after its header.
+#define bloop_chunk_data(c) ((char *)bloop_align((uintptr_t)((c) + 1)))
+
+static bloop_arena_chunk *bloop_arena_new_chunk(size_t size) {
+    bloop_arena_chunk *chunk = malloc(sizeof(bloop_arena_chunk) + BLOOP_ARENA_ALIGN + size);
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+bloop_arena *bloop_arena_new(size_t chunk_size) {
+    bloop_arena *arena = malloc(sizeof(*arena));
+    arena->chunk_size = chunk_size > 0 ? chunk_size : BLOOP_ARENA_CHUNK_SIZE;
+    arena->chunks = bloop_arena_new_chunk(arena->chunk_size);
+    arena->cleanups = NULL;
+    arena->allocated = 0;
+    return arena;
+}
+
+void bloop_arena_free(bloop_arena *arena) {
+    if (bloop_current_arena == arena) {
+        bloop_current_arena = NULL;
+    }
+    for (bloop_arena_cleanup *c = arena->cleanups; c != NULL; c = c->next) {
+        c->fn(c->data);
+    }
+    bloop_arena_chunk *chunk = arena->chunks;
+    while (chunk != NULL) {
+        bloop_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    free(arena);
+}
+
+void *bloop_arena_alloc(bloop_arena *arena, size_t size) {
+    size = bloop_align(size);
+    arena->allocated += size;
+    bloop_arena_chunk *chunk = arena->chunks;
+
+    // Big allocations (e.g. delay lines) get a chunk of their own behind the
+    // current one, so the small ones around them stay together.
+    if (size > arena->chunk_size / 4) {
+        bloop_arena_chunk *big = bloop_arena_new_chunk(size);
+        big->used = size;
+        big->next = chunk->next;
+        chunk->next = big;
+        return bloop_chunk_data(big);
+    }
+
+    if (chunk->used + size > chunk->size) {
+        chunk = bloop_arena_new_chunk(arena->chunk_size);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+    void *p = bloop_chunk_data(chunk) + chunk->used;
+    chunk->used += size;
+    return p;
+}
+
+void bloop_arena_on_free(bloop_arena *arena, bloop_arena_cleanup_fn fn, void *data) {
+    bloop_arena_cleanup *c = bloop_arena_alloc(arena, sizeof(*c));
+    c->next = arena->cleanups;
+    c->fn = fn;
+    c->data = data;
+    arena->cleanups = c;
+}
+
+bloop_arena *bloop_arena_use(bloop_arena *arena) {
+    bloop_arena *previous = bloop_current_arena;
+    bloop_current_arena = arena;
+    return previous;
+}
+
+void *bloop_alloc(size_t size) {
+    if (bloop_current_arena == NULL) {
+        return malloc(size);
+    }
+    return bloop_arena_alloc(bloop_current_arena, size);
+}
+
+void bloop_on_free(bloop_arena_cleanup_fn fn, void *data) {
+    if (bloop_current_arena != NULL) {
+        bloop_arena_on_free(bloop_current_arena, fn, data);
+    }
+}
+
+void *bloop_calloc(size_t count, size_t size) {
+    void *p = bloop_alloc(count * size);
+    memset(p, 0, count * size);
+    return p;
+}
@@ -0,0 +1,62 @@
+#ifndef BLOOP_ARENA
+#define BLOOP_ARENA
+
+#include <stddef.h>
+
+/*
+ * An arena hands out memory from large contiguous chunks and releases all of
+ * it at once. While an arena is in use (see bloop_arena_use), every generator
+ * constructor allocates from it, so a whole patch ends up in a few chunks
+ * that can be freed with a single bloop_arena_free.
+ *
+ * Constructors run after the constructors of their inputs, so the generators
+ * of a patch are laid out inputs first, which is the order they are
+ * evaluated in.
+ *
+ * Some generators are also known outside of their patch, e.g. to a thread
+ * that works ahead for them. They ask to be told when their arena is freed
+ * (see bloop_on_free), so they can be forgotten before their memory goes.
+ */
+
+#define BLOOP_ARENA_CHUNK_SIZE (64 * 1024)
+#define BLOOP_ARENA_ALIGN 32
+
+typedef struct bloop_arena_chunk {
+    struct bloop_arena_chunk *next;
+    size_t size;
+    size_t used;
+} bloop_arena_chunk;
+
+typedef void (*bloop_arena_cleanup_fn)(void *data);
+
+typedef struct bloop_arena_cleanup {
+    struct bloop_arena_cleanup *next;
+    bloop_arena_cleanup_fn fn;
+    void *data;
+} bloop_arena_cleanup;
+
+typedef struct bloop_arena {
+    bloop_arena_chunk *chunks;
+    // Run by bloop_arena_free, newest first, before any chunk is freed.
+    bloop_arena_cleanup *cleanups;
+    size_t chunk_size;
+    size_t allocated;
+} bloop_arena;
+
+bloop_arena *bloop_arena_new(size_t chunk_size);
+void bloop_arena_free(bloop_arena *arena);
+void *bloop_arena_alloc(bloop_arena *arena, size_t size);
+void bloop_arena_on_free(bloop_arena *arena, bloop_arena_cleanup_fn fn, void *data);
+
+// Makes arena the arena used by bloop_alloc and returns the previous one.
+// NULL switches back to malloc.
+bloop_arena *bloop_arena_use(bloop_arena *arena);
+
+// Allocate from the arena in use, or with malloc if there is none.
+void *bloop_alloc(size_t size);
+void *bloop_calloc(size_t count, size_t size);
+// Calls fn(data) when the arena in use is freed. Memory from malloc is never
+// freed, so without an arena in use this does nothing.
+void bloop_on_free(bloop_arena_cleanup_fn fn, void *data);
+
+#endif
@@ -5,25 +5,80 @@
 #include <string.h>
 #include <math.h>
 #include "bloop.h"
-
-bloop_generator* bloop_new_generator(float (*fn)(bloop_generator *, void*, int), enum bloop_generator_type type, char *title, void *userData) {
-    bloop_generator *closure = malloc(sizeof(*closure));
+#include "arena.h"
+#include "fastmath.h"
+#include "sample.h"
+#include "stereo.h"
+#include "oversample.h"
+#include "filter.h"
+#include "convolution.h"
+#include "fdn.h"
+#include "voices.h"
+
+bloop_generator* bloop_new_generator(float (*fn)(bloop_generator *, void*, bloop_tick), enum bloop_generator_type type, char *title, void *userData) {
+    bloop_generator *closure = bloop_alloc(sizeof(*closure));
     closure->fn = fn;
+    closure->block_fn = NULL;
+    closure->segment_fn = NULL;
     closure->type = type;
     closure->userData = userData;
+    closure->inputs = NULL;
     closure->input_count = 0;
-    strncpy(closure->title, title, BLOOP_MAX_TITLE);
-    for (int i = 0; i < BLOOP_MAX_INPUTS; i++) {
-        closure->inputs[i] = NULL;
-        closure->input_descriptions[i] = NULL;
-    }
+    closure->input_blocks = NULL;
+    closure->consumers = 0;
+    closure->cache_tick = -1;
+    closure->cache_pass = 0;
+    closure->cache = NULL;
+    atomic_init(&closure->profile_time, 0);
+    closure->meta = bloop_alloc(sizeof(bloop_generator_meta));
+    strncpy(closure->meta->title, title, BLOOP_MAX_TITLE);
+    closure->meta->input_descriptions = NULL;
+    closure->meta->x = 0;
+    closure->meta->y = 0;
+    closure->meta->modx = 0;
+    closure->meta->plan_mark = 0;
+    closure->meta->plan_branch = 0;
     return closure;
 }
 
+void bloop_set_input_count(bloop_generator *g, int count) {
+    g->inputs = bloop_calloc(count, sizeof(bloop_generator *));
+    g->meta->input_descriptions = bloop_calloc(count, sizeof(bloop_input_description *));
+    g->input_count = count;
+    g->input_blocks = NULL;
+    if (count > BLOOP_MAX_INPUTS) {
+        // The inputs passed to block_fn, followed by a buffer for every input
+        // that doesn't fit on the stack.
+        g->input_blocks = bloop_calloc(count * 2, sizeof(float *));
+        for (int i = BLOOP_MAX_INPUTS; i < count; i++) {
+            g->input_blocks[count + i] = bloop_alloc(sizeof(float) * BLOOP_MAX_BLOCK);
+        }
+    }
+}
+
+static bloop_input_description **bloop_descriptions = NULL;
+static int bloop_description_count = 0;
+
+bloop_input_description *bloop_intern_description(const char *title) {
+    for (int i = 0; i < bloop_description_count; i++) {
+        if (strncmp(bloop_descriptions[i]->title, title, BLOOP_MAX_INPUT_TITLE) == 0) {
+            return bloop_descriptions[i];
+        }
+    }
+    // Not from the arena: descriptions outlive the patches using them.
+    bloop_input_description *d = calloc(1, sizeof(*d));
+    strncpy(d->title, title, BLOOP_MAX_INPUT_TITLE - 1);
+    bloop_descriptions = realloc(bloop_descriptions, sizeof(*bloop_descriptions) * (bloop_description_count + 1));
+    bloop_descriptions[bloop_description_count++] = d;
+    return d;
+}
+
 int bloop_set_generator_input(int input, bloop_generator *g, bloop_generator *input_g, char *title) {
     g->inputs[input] = input_g;
-    g->input_descriptions[input] = malloc(sizeof(bloop_input_description));
-    strncpy(g->input_descriptions[input]->title, title, BLOOP_MAX_INPUT_TITLE);
+    if (input_g != NULL && ++input_g->consumers == 2) {
+        input_g->cache = bloop_alloc(sizeof(float) * BLOOP_MAX_BLOCK);
+    }
+    g->meta->input_descriptions[input] = bloop_intern_description(title);
 }
 
 int bloop_generator_depth(bloop_generator *g) {
@@ -40,23 +95,161 @@ int bloop_generator_depth(bloop_generator *g) {
     return result + 1;
 }
 
+float bloop_run_shared(bloop_generator *g, bloop_tick tick) {
+    if (g->cache_tick != tick) {
+        g->cache_value = (*g->fn)(g, g->userData, tick);
+        g->cache_tick = tick;
+    }
+    return g->cache_value;
+}
+
+// Every call to bloop_run_block(_channels) starts a new pass; generators with
+// more than one consumer are rendered only once per pass.
+static unsigned int bloop_pass_counter = 0;
+static unsigned int bloop_pass = 0;
+
+static void bloop_run_block_(bloop_generator *g, float *out, int n, bloop_tick tick);
+
+void bloop_run_block(bloop_generator *g, float *out, int n, bloop_tick tick) {
+    bloop_run_block_channels(1, &g, &out, n, tick);
+}
+
+void bloop_run_block_channels(int channels, bloop_generator **roots, float **outs, int n, bloop_tick tick) {
+    unsigned int previous = bloop_pass;
+    bloop_pass = ++bloop_pass_counter;
+    for (int c = 0; c < channels; c++) {
+        bloop_run_block_(roots[c], outs[c], n, tick);
+    }
+    bloop_pass = previous;
+}
+
+static void bloop_run_block_uncached(bloop_generator *g, float *out, int n, bloop_tick tick) {
+    if (g->segment_fn != NULL) {
+        int done = 0;
+        while (done < n) {
+            int input = -1;
+            bloop_tick input_tick = 0;
+            int len = g->segment_fn(g, g->userData, tick + done, n - done, &input, &input_tick);
+            if (input < 0) {
+                memset(out + done, 0, sizeof(float) * len);
+            } else {
+                bloop_run_block(g->inputs[input], out + done, len, input_tick);
+            }
+            done += len;
+        }
+        return;
+    }
+
+    if (g->block_fn == NULL) {
+        for (int i = 0; i < n; i++) {
+            out[i] = bloop_run(g, tick + i);
+        }
+        return;
+    }
+
+    float buffers[BLOOP_MAX_INPUTS][BLOOP_MAX_BLOCK];
+    float *stack_inputs[BLOOP_MAX_INPUTS];
+    float **inputs = stack_inputs;
+    if (g->input_count > BLOOP_MAX_INPUTS) {
+        inputs = g->input_blocks;
+    }
+    for (int i = 0; i < g->input_count; i++) {
+        float *buffer = i < BLOOP_MAX_INPUTS ? buffers[i] : g->input_blocks[g->input_count + i];
+        inputs[i] = NULL;
+        if (g->inputs[i] != NULL) {
+            bloop_run_block_(g->inputs[i], buffer, n, tick);
+            inputs[i] = buffer;
+        }
+    }
+    g->block_fn(g, g->userData, inputs, out, n, tick);
+}
+
+static void bloop_run_block_(bloop_generator *g, float *out, int n, bloop_tick tick) {
+    if (g->consumers < 2) {
+        bloop_run_block_uncached(g, out, n, tick);
+        return;
+    }
+    if (g->cache_pass != bloop_pass) {
+        bloop_run_block_uncached(g, g->cache, n, tick);
+        g->cache_pass = bloop_pass;
+    }
+    memcpy(out, g->cache, sizeof(float) * n);
+}
+
+void bloop_render(bloop_generator *g, float *out, int frames, bloop_tick tick) {
+    for (int i = 0; i < frames; i += BLOOP_MAX_BLOCK) {
+        int n = frames - i < BLOOP_MAX_BLOCK ? frames - i : BLOOP_MAX_BLOCK;
+        bloop_run_block(g, out + i, n, tick + i);
+    }
+}
+
 int SAMPLE_RATE = 44100;
 
 
-float bloop_sine_wave_(bloop_generator *g, void *value, int tick) {
+float bloop_sine_wave_(bloop_generator *g, void *value, bloop_tick tick) {
     bloop_sine_wave_data *data = (bloop_sine_wave_data *) value;
     float pitch = bloop_run_input(g, SINE_WAVE_PITCH, tick);
     float p = fmin(fmax(pitch, 0.0), SAMPLE_RATE/2.0);
     float step_size = (p * 2 * M_PI) / (float) SAMPLE_RATE;
-    float result = sin(data->phase) * bloop_run_input(g, SINE_WAVE_GAIN, tick);
+    float result = bloop_fast_sin(data->phase) * bloop_run_input(g, SINE_WAVE_GAIN, tick);
     data->phase += step_size;
+    if (data->phase >= BLOOP_TWO_PI) {
+        data->phase -= BLOOP_TWO_PI;
+    }
     return result;
 }
 
+void bloop_sine_wave_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_sine_wave_data *data = (bloop_sine_wave_data *) value;
+    float *pitch = inputs[SINE_WAVE_PITCH];
+    float *gain = inputs[SINE_WAVE_GAIN];
+    float phase = data->phase;
+    for (int i = 0; i < n; i++) {
+        float p = fmin(fmax(pitch[i], 0.0), SAMPLE_RATE/2.0);
+        float step_size = (p * 2 * M_PI) / (float) SAMPLE_RATE;
+        out[i] = phase;
+        phase += step_size;
+        if (phase >= BLOOP_TWO_PI) {
+            phase -= BLOOP_TWO_PI;
+        }
+    }
+    data->phase = phase;
+
+    // The phases are in out, the sine replaces them.
+    bloop_fast_sin_block(out, out, n);
+    for (int i = 0; i < n; i++) {
+        out[i] *= gain[i];
+    }
+}
+
+void bloop_sine_wave_constant_pitch_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_sine_wave_data *data = (bloop_sine_wave_data *) value;
+    float *gain = inputs[SINE_WAVE_GAIN];
+    float p = fmin(fmax(inputs[SINE_WAVE_PITCH][0], 0.0), SAMPLE_RATE/2.0);
+    float step_size = (p * 2 * M_PI) / (float) SAMPLE_RATE;
+    float phase = data->phase;
+    for (int i = 0; i < n; i++) {
+        out[i] = phase;
+        phase += step_size;
+        if (phase >= BLOOP_TWO_PI) {
+            phase -= BLOOP_TWO_PI;
+        }
+    }
+    data->phase = phase;
+
+    // The phases are in out, the sine replaces them.
+    bloop_fast_sin_block(out, out, n);
+    for (int i = 0; i < n; i++) {
+        out[i] *= gain[i];
+    }
+}
+
 bloop_generator *bloop_sine_wave(bloop_generator *pitch, bloop_generator *gain) {
-    bloop_sine_wave_data *v = malloc(sizeof(bloop_sine_wave_data));
+    bloop_sine_wave_data *v = bloop_alloc(sizeof(bloop_sine_wave_data));
+    v->phase = 0.0;
     bloop_generator *g = bloop_new_generator(bloop_sine_wave_, BLOOP_SINE, "SINE", v);
-    g->input_count = 2;
+    g->block_fn = bloop_sine_wave_block_;
+    bloop_set_input_count(g, 2);
     bloop_set_generator_input(SINE_WAVE_PITCH, g, pitch, "pitch");
     bloop_set_generator_input(SINE_WAVE_GAIN, g, gain, "gain");
     return g;
@@ -64,34 +257,56 @@ bloop_generator *bloop_sine_wave(bloop_generator *pitch, bloop_generator *gain)
 
 
 
-float bloop_white_noise_(bloop_generator *g, void *value, int tick) {
-    float v = (float)rand()/(float)(RAND_MAX/2.0) - -1;
+float bloop_white_noise_(bloop_generator *g, void *value, bloop_tick tick) {
+    bloop_white_noise_data *data = (bloop_white_noise_data *) value;
+    float v = bloop_random_next(&data->random);
     return v * bloop_run_input(g, WHITE_NOISE_GAIN, tick);
 }
 
+void bloop_white_noise_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_white_noise_data *data = (bloop_white_noise_data *) value;
+    float *gain = inputs[WHITE_NOISE_GAIN];
+    bloop_random_fill(&data->random, out, n);
+    for (int i = 0; i < n; i++) {
+        out[i] *= gain[i];
+    }
+}
+
 bloop_generator *bloop_white_noise(bloop_generator *gain) {
-    bloop_generator *g = bloop_new_generator(bloop_white_noise_, BLOOP_WHITE_NOISE, "NOISE", NULL);
-    g->input_count = 1;
-    g->inputs[WHITE_NOISE_GAIN] = gain;
+    bloop_white_noise_data *v = bloop_alloc(sizeof(*v));
+    bloop_random_init(&v->random);
+    bloop_generator *g = bloop_new_generator(bloop_white_noise_, BLOOP_WHITE_NOISE, "NOISE", v);
+    g->block_fn = bloop_white_noise_block_;
+    bloop_set_input_count(g, 1);
+    bloop_set_generator_input(WHITE_NOISE_GAIN, g, gain, "gain");
     return g;
 }
 
 
 
-float bloop_constant_(bloop_generator *g, void *value, int tick) {
+float bloop_constant_(bloop_generator *g, void *value, bloop_tick tick) {
     float *v = (float *)value;
     return *v;
 }
 
+void bloop_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    float v = *(float *)value;
+    for (int i = 0; i < n; i++) {
+        out[i] = v;
+    }
+}
+
 bloop_generator *bloop_constant(float value) {
-    float *v = malloc(sizeof(float));
+    float *v = bloop_alloc(sizeof(float));
     *v = value;
-    return bloop_new_generator(bloop_constant_, BLOOP_CONSTANT, "CONSTANT", v); 
+    bloop_generator *g = bloop_new_generator(bloop_constant_, BLOOP_CONSTANT, "CONSTANT", v); 
+    g->block_fn = bloop_constant_block_;
+    return g;
 }
 
 
 
-float bloop_interpolation_(bloop_generator *g, void *value, int tick) {
+float bloop_interpolation_(bloop_generator *g, void *value, bloop_tick tick) {
     bloop_interpolation_data *data = (bloop_interpolation_data*) value;
     if (tick >= data->over) {
         return data->to;
@@ -100,17 +315,25 @@ float bloop_interpolation_(bloop_generator *g, void *value, int tick) {
     return ((float)tick) * stepSize + data->from;
 }
 
+void bloop_interpolation_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    for (int i = 0; i < n; i++) {
+        out[i] = bloop_interpolation_(g, value, tick + i);
+    }
+}
+
 bloop_generator *bloop_interpolation(float from, float to, int over) {
-    bloop_interpolation_data *v = malloc(sizeof(*v));
+    bloop_interpolation_data *v = bloop_alloc(sizeof(*v));
     v->from = from;
     v->to = to;
     v->over = over;
-    return bloop_new_generator(bloop_interpolation_, BLOOP_INTERPOLATION, "INTERPOLATION", v);
+    bloop_generator *g = bloop_new_generator(bloop_interpolation_, BLOOP_INTERPOLATION, "INTERPOLATION", v);
+    g->block_fn = bloop_interpolation_block_;
+    return g;
 }
 
 
 
-float bloop_adsr_(bloop_generator *g, void *value, int tick) {
+float bloop_adsr_(bloop_generator *g, void *value, bloop_tick tick) {
     bloop_adsr_data *data = (bloop_adsr_data*)value;
     if (tick <= data->attack_samples) {
         float step_size = data->max_gain / ((float)data->attack_samples);
@@ -136,40 +359,83 @@ float bloop_adsr_(bloop_generator *g, void *value, int tick) {
     return 0.0;
 }
 
+void bloop_adsr_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    for (int i = 0; i < n; i++) {
+        out[i] = bloop_adsr_(g, value, tick + i);
+    }
+}
+
 bloop_generator *bloop_adsr(float max_gain, float sustain, int attack_samples, int decay_samples, int sustain_samples, int release_samples) {
-    bloop_adsr_data *v = malloc(sizeof(*v));
+    bloop_adsr_data *v = bloop_alloc(sizeof(*v));
     v->max_gain = max_gain;
     v->sustain = sustain;
     v->attack_samples = attack_samples;
     v->decay_samples = decay_samples;
     v->sustain_samples = sustain_samples;
     v->release_samples = release_samples;
-    return bloop_new_generator(bloop_adsr_, BLOOP_ADSR, "ADSR", v);
+    bloop_generator *g = bloop_new_generator(bloop_adsr_, BLOOP_ADSR, "ADSR", v);
+    g->block_fn = bloop_adsr_block_;
+    return g;
 }
 
 
 
 
-float bloop_lfo_(bloop_generator *g, void *value, int tick) {
+// The phase of an LFO in cycles, wrapped to [0, 1). It is calculated from
+// the absolute tick in double precision, so it doesn't drift however long
+// the LFO has been running, and every sample only depends on its own tick:
+// the per-sample and block paths agree whatever the block size.
+static double bloop_lfo_phase(float speed, bloop_tick tick) {
+    double cycles = (double)tick * speed / SAMPLE_RATE;
+    return cycles - floor(cycles);
+}
+
+float bloop_lfo_(bloop_generator *g, void *value, bloop_tick tick) {
     float speed  = bloop_run_input(g, BLOOP_LFO_SPEED, tick);
     float offset = bloop_run_input(g, BLOOP_LFO_OFFSET, tick);
     float amount = bloop_run_input(g, BLOOP_LFO_AMOUNT, tick);
+    float phase = (float)(BLOOP_TWO_PI * bloop_lfo_phase(speed, tick));
+    return bloop_fast_sin(phase) * amount + offset;
+}
+
+void bloop_lfo_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    float *speed  = inputs[BLOOP_LFO_SPEED];
+    float *offset = inputs[BLOOP_LFO_OFFSET];
+    float *amount = inputs[BLOOP_LFO_AMOUNT];
+    for (int i = 0; i < n; i++) {
+        out[i] = (float)(BLOOP_TWO_PI * bloop_lfo_phase(speed[i], tick + i));
+    }
+    bloop_fast_sin_block(out, out, n);
+    for (int i = 0; i < n; i++) {
+        out[i] = out[i] * amount[i] + offset[i];
+    }
+}
 
-    float stepSize = (speed * M_PI * 2) / (float) SAMPLE_RATE;
-    return sin((float)tick * stepSize) * amount + offset;
+void bloop_lfo_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    float speed = inputs[BLOOP_LFO_SPEED][0];
+    float offset = inputs[BLOOP_LFO_OFFSET][0];
+    float amount = inputs[BLOOP_LFO_AMOUNT][0];
+    for (int i = 0; i < n; i++) {
+        out[i] = (float)(BLOOP_TWO_PI * bloop_lfo_phase(speed, tick + i));
+    }
+    bloop_fast_sin_block(out, out, n);
+    for (int i = 0; i < n; i++) {
+        out[i] = out[i] * amount + offset;
+    }
 }
 
 bloop_generator *bloop_lfo(bloop_generator *speed, bloop_generator *offset, bloop_generator *amount) {
     bloop_generator *g = bloop_new_generator(bloop_lfo_, BLOOP_LFO, "LFO", NULL);
-    g->input_count = 3;
-    g->inputs[BLOOP_LFO_SPEED] = speed;
-    g->inputs[BLOOP_LFO_OFFSET] = offset;
-    g->inputs[BLOOP_LFO_AMOUNT] = amount;
+    g->block_fn = bloop_lfo_block_;
+    bloop_set_input_count(g, 3);
+    bloop_set_generator_input(BLOOP_LFO_SPEED, g, speed, "speed");
+    bloop_set_generator_input(BLOOP_LFO_OFFSET, g, offset, "offset");
+    bloop_set_generator_input(BLOOP_LFO_AMOUNT, g, amount, "amount");
     return g;
 }
 
 
-float bloop_distortion_(bloop_generator *g, void *value, int tick) {
+float bloop_distortion_(bloop_generator *g, void *value, bloop_tick tick) {
     float s    = bloop_run_input(g, BLOOP_DISTORTION_INPUT, tick);
     float lvl  = bloop_run_input(g, BLOOP_DISTORTION_LEVEL, tick);
     float gain = bloop_run_input(g, BLOOP_DISTORTION_GAIN, tick);
@@ -181,88 +447,219 @@ float bloop_distortion_(bloop_generator *g, void *value, int tick) {
     return s * gain;
 }
 
+void bloop_distortion_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    float *input = inputs[BLOOP_DISTORTION_INPUT];
+    float *lvl   = inputs[BLOOP_DISTORTION_LEVEL];
+    float *gain  = inputs[BLOOP_DISTORTION_GAIN];
+    for (int i = 0; i < n; i++) {
+        float s = input[i];
+        if (s >= lvl[i]) {
+            s = lvl[i];
+        } else if (s <= -1*lvl[i]) {
+            s = -1 * lvl[i];
+        }
+        out[i] = s * gain[i];
+    }
+}
+
+void bloop_distortion_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    float *input = inputs[BLOOP_DISTORTION_INPUT];
+    float lvl    = inputs[BLOOP_DISTORTION_LEVEL][0];
+    float gain   = inputs[BLOOP_DISTORTION_GAIN][0];
+    for (int i = 0; i < n; i++) {
+        float s = input[i];
+        s = s >= lvl ? lvl : (s <= -1*lvl ? -1*lvl : s);
+        out[i] = s * gain;
+    }
+}
+
 bloop_generator *bloop_distortion(bloop_generator *input, bloop_generator *level, bloop_generator *gain) {
     bloop_generator *g = bloop_new_generator(bloop_distortion_, BLOOP_DISTORTION, "DISTORTION", NULL);
-    g->input_count = 3;
-    g->inputs[BLOOP_DISTORTION_INPUT] = input;
-    g->inputs[BLOOP_DISTORTION_LEVEL] = level;
-    g->inputs[BLOOP_DISTORTION_GAIN] = gain;
+    g->block_fn = bloop_distortion_block_;
+    bloop_set_input_count(g, 3);
+    bloop_set_generator_input(BLOOP_DISTORTION_INPUT, g, input, "input");
+    bloop_set_generator_input(BLOOP_DISTORTION_LEVEL, g, level, "level");
+    bloop_set_generator_input(BLOOP_DISTORTION_GAIN, g, gain, "gain");
     return g;
 }
 
 
 
-float bloop_delay_(bloop_generator *g, void *value, int tick) {
+// Reads the ring delay samples back, interpolating between the two nearest
+// samples when delay has a fraction. Delays are clamped to [1, max_delay].
+#define bloop_delay_clamp(data, delay) (fminf(fmaxf((delay), 1.0f), (float)(data)->max_delay))
+
+static inline float bloop_delay_read(bloop_delay_data *data, int index, float delay) {
+    int whole = (int)delay;
+    float fraction = delay - whole;
+    float a = data->ring[(index - whole) & data->mask];
+    float b = data->ring[(index - whole - 1) & data->mask];
+    return a + fraction * (b - a);
+}
+
+float bloop_delay_(bloop_generator *g, void *value, bloop_tick tick) {
     bloop_delay_data *data = (bloop_delay_data *) value;
-    float s           = bloop_run_input(g, BLOOP_DELAY_INPUT, tick);
-    float factor      = bloop_run_input(g, BLOOP_DELAY_FACTOR, tick);
-    float feedback    = bloop_run_input(g, BLOOP_DELAY_FEEDBACK, tick);
-    int delay_samples = (int)bloop_run_input(g, BLOOP_DELAY_SAMPLES, tick);
+    float s        = bloop_run_input(g, BLOOP_DELAY_INPUT, tick);
+    float factor   = bloop_run_input(g, BLOOP_DELAY_FACTOR, tick);
+    float feedback = bloop_run_input(g, BLOOP_DELAY_FEEDBACK, tick);
+    float delay    = bloop_delay_clamp(data, bloop_run_input(g, BLOOP_DELAY_SAMPLES, tick));
+
+    float prev = bloop_delay_read(data, data->ring_index, delay);
+    float out = s + prev * factor;
+    data->ring[data->ring_index] = s + feedback * out;
+    data->ring_index = (data->ring_index + 1) & data->mask;
+    return out;
+}
 
-    int prev_index = (data->ring_index - delay_samples);
-    if (prev_index < 0) {
-        prev_index = 8 * SAMPLE_RATE + prev_index;
+void bloop_delay_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_delay_data *data = (bloop_delay_data *) value;
+    float *input    = inputs[BLOOP_DELAY_INPUT];
+    float *samples  = inputs[BLOOP_DELAY_SAMPLES];
+    float *factor   = inputs[BLOOP_DELAY_FACTOR];
+    float *feedback = inputs[BLOOP_DELAY_FEEDBACK];
+    for (int i = 0; i < n; i++) {
+        float prev = bloop_delay_read(data, data->ring_index, bloop_delay_clamp(data, samples[i]));
+        float s = input[i] + prev * factor[i];
+        data->ring[data->ring_index] = input[i] + feedback[i] * s;
+        data->ring_index = (data->ring_index + 1) & data->mask;
+        out[i] = s;
     }
-    float prev = data->ring[prev_index];
-    data->ring[data->ring_index] = s;
-    s += prev * factor;
-    data->ring[data->ring_index] += feedback * s;
-    data->ring_index = (data->ring_index + 1) % (8 * SAMPLE_RATE);
-    return s;
 }
 
-bloop_generator *bloop_delay(bloop_generator *input, bloop_generator *delay_samples, bloop_generator *factor, bloop_generator *feedback) {
-    bloop_delay_data *v = malloc(sizeof(*v));
+// Copies n samples from the ring starting at index to out, or back.
+static void bloop_delay_copy(bloop_delay_data *data, int index, float *samples, int n, int to_ring) {
+    index &= data->mask;
+    int first = data->mask + 1 - index < n ? data->mask + 1 - index : n;
+    if (to_ring) {
+        memcpy(data->ring + index, samples, sizeof(float) * first);
+        memcpy(data->ring, samples + first, sizeof(float) * (n - first));
+    } else {
+        memcpy(samples, data->ring + index, sizeof(float) * first);
+        memcpy(samples + first, data->ring, sizeof(float) * (n - first));
+    }
+}
+
+// With a constant delay of at least n samples, the samples a block reads were
+// all written before the block, so they can be copied out of the ring in one
+// go and the block is written back in one go as well.
+void bloop_delay_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_delay_data *data = (bloop_delay_data *) value;
+    float delay = bloop_delay_clamp(data, inputs[BLOOP_DELAY_SAMPLES][0]);
+    int whole = (int)delay;
+    if (whole < n) {
+        bloop_delay_block_(g, value, inputs, out, n, tick);
+        return;
+    }
+    float fraction = delay - whole;
+    float *input    = inputs[BLOOP_DELAY_INPUT];
+    float *factor   = inputs[BLOOP_DELAY_FACTOR];
+    float *feedback = inputs[BLOOP_DELAY_FEEDBACK];
+    // delayed[i + 1] is the sample delay samples before tick + i, delayed[i]
+    // the one before that.
+    float delayed[BLOOP_MAX_BLOCK + 1];
+    float written[BLOOP_MAX_BLOCK];
+    bloop_delay_copy(data, data->ring_index - whole - 1, delayed, n + 1, 0);
+    for (int i = 0; i < n; i++) {
+        float a = delayed[i + 1];
+        float prev = a + fraction * (delayed[i] - a);
+        float s = input[i] + prev * factor[i];
+        written[i] = input[i] + feedback[i] * s;
+        out[i] = s;
+    }
+    bloop_delay_copy(data, data->ring_index, written, n, 1);
+    data->ring_index = (data->ring_index + n) & data->mask;
+}
+
+int bloop_delay_ring_size(int *max_delay_samples) {
+    int max = *max_delay_samples;
+    max = max > 1 ? max : 1;
+    max = max < BLOOP_MAX_DELAY ? max : BLOOP_MAX_DELAY;
+    *max_delay_samples = max;
+    int size = 1;
+    while (size < max + 2) {
+        size *= 2;
+    }
+    return size;
+}
+
+bloop_generator *bloop_delay(bloop_generator *input, bloop_generator *delay_samples, bloop_generator *factor, bloop_generator *feedback, int max_delay_samples) {
+    bloop_delay_data *v = bloop_alloc(sizeof(*v));
+    int size = bloop_delay_ring_size(&max_delay_samples);
     v->ring_index = 0;
-    v->ring = malloc(sizeof(float) * 8 * SAMPLE_RATE); // allocate 8 seconds 
+    v->mask = size - 1;
+    v->max_delay = max_delay_samples;
+    v->ring = bloop_calloc(size, sizeof(float));
     bloop_generator *g = bloop_new_generator(bloop_delay_, BLOOP_DELAY, "DELAY", v);
-    g->input_count = 4;
-    g->inputs[BLOOP_DELAY_INPUT] = input;
-    g->inputs[BLOOP_DELAY_SAMPLES] = delay_samples;
-    g->inputs[BLOOP_DELAY_FACTOR] = factor;
-    g->inputs[BLOOP_DELAY_FEEDBACK] = feedback;
+    g->block_fn = bloop_delay_block_;
+    bloop_set_input_count(g, 4);
+    bloop_set_generator_input(BLOOP_DELAY_INPUT, g, input, "input");
+    bloop_set_generator_input(BLOOP_DELAY_SAMPLES, g, delay_samples, "samples");
+    bloop_set_generator_input(BLOOP_DELAY_FACTOR, g, factor, "factor");
+    bloop_set_generator_input(BLOOP_DELAY_FEEDBACK, g, feedback, "feedback");
     return g;
 }
 
 
 
-float bloop_repeat_(bloop_generator *g, void *value, int tick) {
+float bloop_repeat_(bloop_generator *g, void *value, bloop_tick tick) {
     bloop_repeat_data *data = (bloop_repeat_data *) value;
     return bloop_run_input(g, BLOOP_REPEAT_INPUT, tick % data->every);
 }
 
+int bloop_repeat_segment_(bloop_generator *g, void *value, bloop_tick tick, int n, int *input, bloop_tick *input_tick) {
+    bloop_repeat_data *data = (bloop_repeat_data *) value;
+    *input = BLOOP_REPEAT_INPUT;
+    *input_tick = tick % data->every;
+    int left = (int)(data->every - *input_tick);
+    return left < n ? left : n;
+}
+
 bloop_generator *bloop_repeat(bloop_generator *input, int every) {
-    bloop_repeat_data *v = malloc(sizeof(*v));
+    bloop_repeat_data *v = bloop_alloc(sizeof(*v));
     v->every = every;
     bloop_generator *g = bloop_new_generator(bloop_repeat_, BLOOP_REPEAT, "REPEAT", v);
-    g->input_count = 1;
-    g->inputs[BLOOP_REPEAT_INPUT] = input;
+    g->segment_fn = bloop_repeat_segment_;
+    bloop_set_input_count(g, 1);
+    bloop_set_generator_input(BLOOP_REPEAT_INPUT, g, input, "input");
     return g;
 }
 
 
 
-float bloop_offset_(bloop_generator *g, void *value, int tick) {
+float bloop_offset_(bloop_generator *g, void *value, bloop_tick tick) {
     bloop_offset_data *data = (bloop_offset_data*)value;
-    int t = tick - data->offset;
+    bloop_tick t = tick - data->offset;
     if (t >= 0) {
         return bloop_run_input(g, BLOOP_OFFSET_INPUT, t);
     }
     return 0.0;
 }
 
+int bloop_offset_segment_(bloop_generator *g, void *value, bloop_tick tick, int n, int *input, bloop_tick *input_tick) {
+    bloop_offset_data *data = (bloop_offset_data*)value;
+    bloop_tick t = tick - data->offset;
+    if (t >= 0) {
+        *input = BLOOP_OFFSET_INPUT;
+        *input_tick = t;
+        return n;
+    }
+    *input = -1;
+    return -t < n ? (int)-t : n;
+}
+
 bloop_generator *bloop_offset(bloop_generator *input, int offset) {
-    bloop_offset_data *v = malloc(sizeof(*v));
+    bloop_offset_data *v = bloop_alloc(sizeof(*v));
     v->offset = offset;
     bloop_generator *g = bloop_new_generator(bloop_offset_, BLOOP_OFFSET, "OFFSET", v);
-    g->input_count = 1;
-    g->inputs[BLOOP_OFFSET_INPUT] = input;
+    g->segment_fn = bloop_offset_segment_;
+    bloop_set_input_count(g, 1);
+    bloop_set_generator_input(BLOOP_OFFSET_INPUT, g, input, "input");
     return g;
 }
 
 
 
-float bloop_average_(bloop_generator *g, void *value, int tick) {
+float bloop_average_(bloop_generator *g, void *value, bloop_tick tick) {
     float s = 0.0;
     for (int i = 0; i < g->input_count; i++) {
         s += bloop_run(g->inputs[i], tick);
@@ -270,52 +667,384 @@ float bloop_average_(bloop_generator *g, void *value, int tick) {
     return s / ((float)g->input_count);
 }
 
-bloop_generator *bloop_average(int count, ...) {
+void bloop_average_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    for (int i = 0; i < n; i++) {
+        out[i] = 0.0;
+    }
+    for (int j = 0; j < g->input_count; j++) {
+        for (int i = 0; i < n; i++) {
+            out[i] += inputs[j][i];
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        out[i] /= (float)g->input_count;
+    }
+}
+
+bloop_generator *bloop_average_array(int count, bloop_generator **inputs) {
     bloop_generator *g = bloop_new_generator(bloop_average_, BLOOP_AVERAGE, "AVERAGE", NULL);
-    g->input_count = count;
+    g->block_fn = bloop_average_block_;
+    bloop_set_input_count(g, count);
+    for (int i = 0; i < count; i++) {
+        bloop_set_generator_input(i, g, inputs[i], "input");
+    }
+    return g;
+}
+
+bloop_generator *bloop_average(int count, ...) {
+    bloop_generator **inputs = malloc(sizeof(bloop_generator *) * count);
     va_list args;
     va_start(args, count);
     for (int i = 0; i < count; i++) {
-        g->inputs[i] = va_arg(args, bloop_generator*);
+        inputs[i] = va_arg(args, bloop_generator*);
     }
+    va_end(args);
+    bloop_generator *g = bloop_average_array(count, inputs);
+    free(inputs);
     return g;
 }
 
-float bloop_sequence_(bloop_generator *g, void *value, int tick) {
-    int t = 0;
-    for (int i = 0; i < g->input_count; i++) {
-        int endsAfter = ((int*)g->userData)[i];
-        if (tick < endsAfter) {
-            return bloop_run(g->inputs[i], tick - t);
+// Returns the step playing at tick, or -1 after the last step. Ticks usually
+// go up one block at a time, so the step at the cursor or the one after it
+// is checked first; anything else is a jump and is looked up with a binary
+// search.
+static int bloop_sequence_find(bloop_sequence_data *data, bloop_tick tick) {
+    if (data->count == 0) {
+        return -1;
+    }
+    int c = data->cursor;
+    if (tick < data->ends[c] && (c == 0 || tick >= data->ends[c - 1])) {
+        return c;
+    }
+    if (c + 1 < data->count && tick >= data->ends[c] && tick < data->ends[c + 1]) {
+        data->cursor = c + 1;
+        return c + 1;
+    }
+    if (tick < 0 || tick >= data->ends[data->count - 1]) {
+        return -1;
+    }
+    int low = 0;
+    int high = data->count - 1;
+    while (low < high) {
+        int mid = (low + high) / 2;
+        if (tick < data->ends[mid]) {
+            high = mid;
+        } else {
+            low = mid + 1;
         }
-        t = endsAfter;
     }
-    return 0.0;
+    data->cursor = low;
+    return low;
 }
 
+#define bloop_sequence_start(data, step) ((step) == 0 ? 0 : (data)->ends[(step) - 1])
+
+float bloop_sequence_(bloop_generator *g, void *value, bloop_tick tick) {
+    bloop_sequence_data *data = (bloop_sequence_data *) value;
+    int step = bloop_sequence_find(data, tick);
+    if (step < 0) {
+        return 0.0;
+    }
+    return bloop_run(g->inputs[step], tick - bloop_sequence_start(data, step));
+}
+
+int bloop_sequence_segment_(bloop_generator *g, void *value, bloop_tick tick, int n, int *input, bloop_tick *input_tick) {
+    bloop_sequence_data *data = (bloop_sequence_data *) value;
+    int step = bloop_sequence_find(data, tick);
+    *input = step;
+    if (step < 0) {
+        return n;
+    }
+    *input_tick = tick - bloop_sequence_start(data, step);
+    bloop_tick left = data->ends[step] - tick;
+    return left < n ? (int)left : n;
+}
+
+bloop_generator *bloop_sequence_array(int count, bloop_generator **steps, int *lengths) {
+    bloop_sequence_data *v = bloop_alloc(sizeof(*v));
+    v->count = count;
+    v->cursor = 0;
+    v->ends = bloop_alloc(sizeof(bloop_tick) * count);
+    bloop_generator *g = bloop_new_generator(bloop_sequence_, BLOOP_SEQUENCE, "SEQUENCE", v);
+    g->segment_fn = bloop_sequence_segment_;
+    bloop_set_input_count(g, count);
+    bloop_tick end = 0;
+    for (int i = 0; i < count; i++) {
+        bloop_set_generator_input(i, g, steps[i], "step");
+        end += lengths[i];
+        v->ends[i] = end;
+    }
+    return g;
+}
 
 bloop_generator *bloop_sequence(int count, ...) {
-    bloop_generator *g = bloop_new_generator(bloop_sequence_, BLOOP_SEQUENCE, "SEQUENCE", NULL);
-    g->input_count = count;
-    int *data = malloc(sizeof(int*) * count);
+    bloop_generator **steps = malloc(sizeof(bloop_generator *) * count);
+    int *lengths = malloc(sizeof(int) * count);
     va_list args;
     va_start(args, count);
-    int runningTotal = 0;
-    for (int i = 0; i < count * 2; i = i+2) {
-        g->inputs[i / 2] = va_arg(args, bloop_generator*);
-        int v = va_arg(args, int);
-        data[i/2] = v + runningTotal;
-        runningTotal += v;
-    }
-    g->userData = data;
+    for (int i = 0; i < count; i++) {
+        steps[i] = va_arg(args, bloop_generator*);
+        lengths[i] = va_arg(args, int);
+    }
+    va_end(args);
+    bloop_generator *g = bloop_sequence_array(count, steps, lengths);
+    free(steps);
+    free(lengths);
     return g;
 }
 
 
+
+float bloop_param_(bloop_generator *g, void *value, bloop_tick tick) {
+    bloop_param_data *data = (bloop_param_data *) value;
+    float target = atomic_load_explicit(&data->target, memory_order_relaxed);
+    float result = data->value;
+    data->value += (target - data->value) * data->smoothing;
+    if (fabsf(target - data->value) < BLOOP_PARAM_EPSILON) {
+        data->value = target;
+    }
+    return result;
+}
+
+void bloop_param_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_param_data *data = (bloop_param_data *) value;
+    float target = atomic_load_explicit(&data->target, memory_order_relaxed);
+    float v = data->value;
+    if (v == target) {
+        for (int i = 0; i < n; i++) {
+            out[i] = v;
+        }
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        out[i] = v;
+        v += (target - v) * data->smoothing;
+        if (fabsf(target - v) < BLOOP_PARAM_EPSILON) {
+            v = target;
+        }
+    }
+    data->value = v;
+}
+
+// Keeps value in [min, max]; NaN becomes min.
+static float bloop_param_clamp(const bloop_param_data *data, float value) {
+    if (!(value >= data->min)) {
+        return data->min;
+    }
+    return value < data->max ? value : data->max;
+}
+
+bloop_generator *bloop_param(float value, float min, float max, int smoothing_samples) {
+    bloop_param_data *v = bloop_alloc(sizeof(*v));
+    v->min = min;
+    v->max = max > min ? max : min;
+    value = bloop_param_clamp(v, value);
+    atomic_init(&v->target, value);
+    v->value = value;
+    v->smoothing = smoothing_samples > 0 ? 1.0 - exp(-1.0 / smoothing_samples) : 1.0;
+    bloop_generator *g = bloop_new_generator(bloop_param_, BLOOP_PARAM, "PARAM", v);
+    g->block_fn = bloop_param_block_;
+    return g;
+}
+
+void bloop_param_set(bloop_generator *g, float value) {
+    bloop_param_data *data = (bloop_param_data *) g->userData;
+    atomic_store_explicit(&data->target, bloop_param_clamp(data, value), memory_order_relaxed);
+}
+
+float bloop_param_get(bloop_generator *g) {
+    bloop_param_data *data = (bloop_param_data *) g->userData;
+    return atomic_load_explicit(&data->target, memory_order_relaxed);
+}
+
+
+void bloop_reset(bloop_generator *g) {
+    g->cache_tick = -1;
+    g->cache_pass = 0;
+    switch (g->type) {
+        case BLOOP_SINE:
+            ((bloop_sine_wave_data *) g->userData)->phase = 0.0;
+            break;
+        case BLOOP_WHITE_NOISE:
+            bloop_random_reset(&((bloop_white_noise_data *) g->userData)->random);
+            break;
+        case BLOOP_DELAY: {
+            bloop_delay_data *data = (bloop_delay_data *) g->userData;
+            data->ring_index = 0;
+            memset(data->ring, 0, sizeof(float) * (data->mask + 1));
+            break;
+        }
+        case BLOOP_SEQUENCE:
+            ((bloop_sequence_data *) g->userData)->cursor = 0;
+            break;
+        case BLOOP_PARAM: {
+            bloop_param_data *data = (bloop_param_data *) g->userData;
+            data->value = atomic_load_explicit(&data->target, memory_order_relaxed);
+            break;
+        }
+        case BLOOP_SAMPLE: {
+            bloop_sample_data *data = (bloop_sample_data *) g->userData;
+            data->position = 0.0;
+            data->last_tick = -1;
+            break;
+        }
+        case BLOOP_STEREO_DELAY: {
+            bloop_stereo_delay_data *data = (bloop_stereo_delay_data *) g->userData;
+            data->ring_index = 0;
+            memset(data->rings[0], 0, sizeof(float) * (data->mask + 1));
+            memset(data->rings[1], 0, sizeof(float) * (data->mask + 1));
+            break;
+        }
+        case BLOOP_OVERSAMPLE:
+            bloop_oversample_clear(g);
+            break;
+        case BLOOP_BIQUAD:
+        case BLOOP_SVF:
+            bloop_filter_clear(g);
+            break;
+        case BLOOP_CONVOLUTION:
+            bloop_convolution_clear(g);
+            break;
+        case BLOOP_FDN:
+            bloop_fdn_clear(g);
+            break;
+        default:
+            break;
+    }
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] != NULL) {
+            bloop_reset(g->inputs[i]);
+        }
+    }
+}
+
+void bloop_free_graph(bloop_generator *g) {
+    switch (g->type) {
+        case BLOOP_VOICES:
+            bloop_voices_free(g);
+            break;
+        case BLOOP_SAMPLE:
+            bloop_sample_free(g);
+            break;
+        case BLOOP_CONVOLUTION:
+            bloop_convolution_free(g);
+            break;
+        default:
+            break;
+    }
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] != NULL) {
+            bloop_free_graph(g->inputs[i]);
+        }
+    }
+}
+
+#define bloop_is_constant(g) ((g) != NULL && (g)->type == BLOOP_CONSTANT)
+
+// Turns g into a constant generator with the given value. Its consumers keep
+// pointing at it, so shared generators are folded only once.
+static void bloop_fold_constant(bloop_generator *g, float value) {
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] != NULL) {
+            g->inputs[i]->consumers--;
+            g->inputs[i] = NULL;
+        }
+    }
+    float *v = bloop_alloc(sizeof(float));
+    *v = value;
+    g->fn = bloop_constant_;
+    g->block_fn = bloop_constant_block_;
+    g->segment_fn = NULL;
+    g->type = BLOOP_CONSTANT;
+    g->userData = v;
+    g->input_count = 0;
+    strncpy(g->meta->title, "CONSTANT", BLOOP_MAX_TITLE);
+}
+
+void bloop_optimize(bloop_generator *g) {
+    int constant_inputs = 1;
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] != NULL) {
+            bloop_optimize(g->inputs[i]);
+            constant_inputs = constant_inputs && bloop_is_constant(g->inputs[i]);
+        }
+    }
+
+    switch (g->type) {
+        case BLOOP_SINE:
+            if (bloop_is_constant(g->inputs[SINE_WAVE_PITCH])) {
+                g->block_fn = bloop_sine_wave_constant_pitch_block_;
+            }
+            break;
+        case BLOOP_LFO:
+            if (constant_inputs) {
+                g->block_fn = bloop_lfo_constant_block_;
+            }
+            break;
+        case BLOOP_DISTORTION:
+            if (constant_inputs) {
+                bloop_fold_constant(g, bloop_run(g, 0));
+            } else if (bloop_is_constant(g->inputs[BLOOP_DISTORTION_LEVEL]) && bloop_is_constant(g->inputs[BLOOP_DISTORTION_GAIN])) {
+                g->block_fn = bloop_distortion_constant_block_;
+            }
+            break;
+        case BLOOP_DELAY:
+            if (bloop_is_constant(g->inputs[BLOOP_DELAY_SAMPLES])) {
+                g->block_fn = bloop_delay_constant_block_;
+            }
+            break;
+        case BLOOP_SAMPLE:
+            if (bloop_is_constant(g->inputs[BLOOP_SAMPLE_SPEED])) {
+                g->block_fn = bloop_sample_constant_block_;
+            }
+            break;
+        case BLOOP_PAN:
+            if (constant_inputs) {
+                bloop_fold_constant(g, bloop_run(g, 0));
+            } else if (bloop_is_constant(g->inputs[BLOOP_PAN_POSITION])) {
+                g->block_fn = bloop_pan_constant_block_;
+            }
+            break;
+        case BLOOP_BIQUAD:
+            if (bloop_is_constant(g->inputs[BLOOP_FILTER_CUTOFF]) && bloop_is_constant(g->inputs[BLOOP_FILTER_RESONANCE])) {
+                g->block_fn = bloop_biquad_constant_block_;
+            }
+            break;
+        case BLOOP_SVF:
+            if (bloop_is_constant(g->inputs[BLOOP_FILTER_CUTOFF]) && bloop_is_constant(g->inputs[BLOOP_FILTER_RESONANCE])) {
+                g->block_fn = bloop_svf_constant_block_;
+            }
+            break;
+        case BLOOP_FDN:
+            if (bloop_is_constant(g->inputs[BLOOP_FDN_DECAY]) && bloop_is_constant(g->inputs[BLOOP_FDN_DAMPING])) {
+                g->block_fn = bloop_fdn_constant_block_;
+            }
+            break;
+        case BLOOP_OVERSAMPLE: {
+            bloop_oversample_optimize(g);
+            // A region of constants is a constant, without the filters
+            // settling first.
+            bloop_generator *region = ((bloop_oversample_data *) g->userData)->region;
+            if (bloop_is_constant(region)) {
+                bloop_fold_constant(g, bloop_run(region, 0));
+            }
+            break;
+        }
+        case BLOOP_AVERAGE:
+        case BLOOP_REPEAT:
+            if (constant_inputs && g->input_count > 0) {
+                bloop_fold_constant(g, bloop_run(g, 0));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
 #define BLOOP_MAX_LAYOUT_DEPTH 100
 
 int __bloop_move_right(bloop_generator *g, int n) {
-    g->x += n;
+    g->meta->x += n;
     for (int i = 0; i < g->input_count; i++) {
         if (g->inputs[i] != NULL) {
             __bloop_move_right(g->inputs[i], n);
@@ -340,17 +1069,17 @@ int __bloop_calculate_layout(bloop_generator *g, int depth, int *nexts, int *off
         }
     }
 
-    g->x = depth;
+    g->meta->x = depth;
 
     int place;
     if (input_count == 0) {
         place = nexts[depth];
-        g->y = place;
+        g->meta->y = place;
     } else if (input_count == 1) {
         // find first input
         for (int i = 0; i < g->input_count; i++) {
             if (g->inputs[i] != NULL) {
-                place = g->inputs[i]->y - 1;
+                place = g->inputs[i]->meta->y - 1;
                 break;
             }
         }
@@ -365,31 +1094,31 @@ int __bloop_calculate_layout(bloop_generator *g, int depth, int *nexts, int *off
         }
         // find last input
         int last = 0;
-        for (int i = g->input_count; i >= 0; i--) {
+        for (int i = g->input_count - 1; i >= 0; i--) {
             if (g->inputs[i] != NULL) {
                 last = i;
                 break;
             }
         }
-        int s = g->inputs[first]->y + g->inputs[last]->y;
+        int s = g->inputs[first]->meta->y + g->inputs[last]->meta->y;
         place = s / 2;
     }
 
     offset[depth]  = (offset[depth] > nexts[depth] - place) ? offset[depth] : (nexts[depth] - place);
 
     if (g->input_count != 0) {
-        g->y = place + offset[depth];
+        g->meta->y = place + offset[depth];
     }
 
     nexts[depth] += 2;
-    g->modx = offset[depth];
+    g->meta->modx = offset[depth];
     return max_depth;
 }
 
 void __bloop_add_mods_and_reverse_x(bloop_generator *g, int modsum, int depth) {
-    g->y = g->y + modsum;
-    g->x = depth - g->x;
-    modsum += g->modx;
+    g->meta->y = g->meta->y + modsum;
+    g->meta->x = depth - g->meta->x;
+    modsum += g->meta->modx;
 
     for (int i = 0; i < g->input_count; i++) {
         if (g->inputs[i] != NULL) {
@@ -402,8 +1131,10 @@ void __bloop_add_mods_and_reverse_x(bloop_generator *g, int modsum, int depth) {
 void bloop_calculate_layout(bloop_generator *g) {
     int *nexts = malloc(sizeof(int) * BLOOP_MAX_LAYOUT_DEPTH);
     int *offset = malloc(sizeof(int) * BLOOP_MAX_LAYOUT_DEPTH);
-    memset(nexts, 0, BLOOP_MAX_LAYOUT_DEPTH);
-    memset(offset, 0, BLOOP_MAX_LAYOUT_DEPTH);
+    memset(nexts, 0, sizeof(int) * BLOOP_MAX_LAYOUT_DEPTH);
+    memset(offset, 0, sizeof(int) * BLOOP_MAX_LAYOUT_DEPTH);
     int depth = __bloop_calculate_layout(g, 0, nexts, offset);
     __bloop_add_mods_and_reverse_x(g, 0, depth);
+    free(nexts);
+    free(offset);
 }
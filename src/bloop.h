@@ -1,6 +1,10 @@
 #ifndef BLOOP
 #define BLOOP
 
+#include <stdatomic.h>
+#include <stdint.h>
+#include "random.h"
+
 /* 
  * Bloop is built around the concept of functions that generate floating point
  * numbers for a given tick.  The tick is simply a counter that denotes what
@@ -24,8 +28,27 @@
  * bloop_sine_wave) that creates the generator.
  *
  * To execute a bloop_generator to get its value, the bloop_run macro can be used.
+ *
+ * Running a generator one sample at a time means walking the whole tree of
+ * function pointers for every tick, so generators can also be rendered a block
+ * at a time with bloop_run_block and bloop_render. Generators that support
+ * this provide a block function (e.g. bloop_sine_wave_block_) that gets
+ * handed fully rendered blocks for each of its inputs and fills an output
+ * block. Generators that play their inputs at different ticks (repeat, offset,
+ * sequence) provide a segment function instead, which splits a block into
+ * runs of consecutive ticks for a single input.
+ *
+ * A generator can be used as the input of more than one other generator. It
+ * is then evaluated only once for every tick (or block) and all of its
+ * consumers get the same output.
  */
 
+// Ticks are 64 bit, so a tick counter at 44.1 kHz doesn't overflow for
+// millions of years.
+typedef int64_t bloop_tick;
+
+// Patch files store these numbers (see patchfile.h), so new types go at the
+// end.
 enum bloop_generator_type {
     BLOOP_SINE,
     BLOOP_WHITE_NOISE,
@@ -39,6 +62,17 @@ enum bloop_generator_type {
     BLOOP_OFFSET,
     BLOOP_AVERAGE,
     BLOOP_SEQUENCE,
+    BLOOP_PARAM,
+    BLOOP_VOICES,
+    BLOOP_SAMPLE,
+    BLOOP_PAN,
+    BLOOP_TAP,
+    BLOOP_STEREO_DELAY,
+    BLOOP_OVERSAMPLE,
+    BLOOP_BIQUAD,
+    BLOOP_SVF,
+    BLOOP_CONVOLUTION,
+    BLOOP_FDN,
 };
 
 #define BLOOP_MAX_INPUT_TITLE 16
@@ -48,31 +82,88 @@ typedef struct bloop_input_description{
     // TODO: enum type (bloop_int, bloop_float, bloop_bool, whatever);
 } bloop_input_description;
 
+// Generators can have any number of inputs; block functions of generators
+// with up to this many inputs get their input blocks rendered on the stack.
 #define BLOOP_MAX_INPUTS 8
 #define BLOOP_MAX_TITLE 16
 
-typedef struct bloop_generator{
-    float (*fn)(struct bloop_generator *, void*, int);
-    enum bloop_generator_type type;
-    void *userData;
+// The maximum number of samples a block function is asked to produce at once.
+#define BLOOP_MAX_BLOCK 256
 
-    int input_count;
-    struct bloop_generator *inputs[BLOOP_MAX_INPUTS];
-    struct bloop_input_description *input_descriptions[BLOOP_MAX_INPUTS];
+// Everything about a generator that isn't needed to render it: its title, the
+// descriptions of its inputs and where the node editor shows it.
+typedef struct bloop_generator_meta {
     char title[BLOOP_MAX_TITLE];
+    // Interned, see bloop_intern_description.
+    struct bloop_input_description **input_descriptions;
 
     int x;
     int y;
     int modx;
+
+    // The input of the average that bloop_plan_compile last checked this
+    // generator for, see bloop_plan_is_parallel.
+    unsigned int plan_mark;
+    int plan_branch;
+} bloop_generator_meta;
+
+// Only the fields needed to render a generator live in the generator itself,
+// so more generators fit in the cache while a patch is rendered.
+typedef struct bloop_generator{
+    float (*fn)(struct bloop_generator *, void*, bloop_tick);
+    // Optional block implementation; gets the rendered input blocks.
+    void (*block_fn)(struct bloop_generator *, void*, float **, float *, int, bloop_tick);
+    // Optional; returns the number of ticks from tick onwards that are
+    // rendered by a single input (or silence if *input is set to -1).
+    int (*segment_fn)(struct bloop_generator *, void*, bloop_tick, int, int *, bloop_tick *);
+    void *userData;
+
+    // Exactly input_count inputs, see bloop_set_input_count.
+    struct bloop_generator **inputs;
+    int input_count;
+    enum bloop_generator_type type;
+    // Input blocks for the tree renderer, only when there are more than
+    // BLOOP_MAX_INPUTS inputs.
+    float **input_blocks;
+
+    // The number of generators using this one as an input. Generators with
+    // more than one consumer are evaluated once per tick (or block) and their
+    // output is shared through the cache.
+    int consumers;
+    unsigned int cache_pass;
+    bloop_tick cache_tick;
+    float cache_value;
+    float *cache;
+
+    // Time spent rendering this generator, see profile.h.
+    atomic_ullong profile_time;
+
+    bloop_generator_meta *meta;
 } bloop_generator;
 
-bloop_generator* bloop_new_generator(float (*fn)(bloop_generator *, void*, int), enum bloop_generator_type type, char *title, void *userData);
+bloop_generator* bloop_new_generator(float (*fn)(bloop_generator *, void*, bloop_tick), enum bloop_generator_type type, char *title, void *userData);
 int bloop_generator_depth(bloop_generator *g);
+// Allocates room for count inputs; constructors call this before setting the
+// inputs.
+void bloop_set_input_count(bloop_generator *g, int count);
+// Returns the shared description with this title; descriptions live as long
+// as the program.
+bloop_input_description *bloop_intern_description(const char *title);
 int bloop_set_generator_input(int input, bloop_generator *g, bloop_generator *input_g, char *title);
 
-#define bloop_run(closure, tick) ((*closure->fn)(closure, closure->userData, tick))
+float bloop_run_shared(bloop_generator *g, bloop_tick tick);
+
+#define bloop_run(closure, tick) ((closure)->consumers > 1 ? bloop_run_shared(closure, tick) : (*(closure)->fn)(closure, (closure)->userData, tick))
 #define bloop_run_input(g, input, tick) (bloop_run(g->inputs[input], tick))
 
+// Render n (<= BLOOP_MAX_BLOCK) samples starting at tick into out.
+void bloop_run_block(bloop_generator *g, float *out, int n, bloop_tick tick);
+// Render a block of every channel in the same pass, so generators shared by
+// the roots are rendered once.
+void bloop_run_block_channels(int channels, bloop_generator **roots, float **outs, int n, bloop_tick tick);
+// Render any number of samples starting at tick into out.
+void bloop_render(bloop_generator *g, float *out, int frames, bloop_tick tick);
+
 #define SINE_WAVE_PITCH 0
 #define SINE_WAVE_GAIN  1
 
@@ -83,6 +174,10 @@ typedef struct bloop_sine_wave_data {
 
 #define WHITE_NOISE_GAIN 0
 
+typedef struct bloop_white_noise_data {
+    bloop_random random;
+} bloop_white_noise_data;
+
 typedef struct bloop_interpolation_data {
     float from;
     float to;
@@ -112,8 +207,16 @@ typedef struct bloop_adsr_data {
 #define BLOOP_DELAY_FACTOR 2
 #define BLOOP_DELAY_FEEDBACK 3
 
+// The longest max_delay_samples of a delay, 2^24 samples (6 minutes at
+// 44.1 kHz, a 64 MB ring).
+#define BLOOP_MAX_DELAY (1 << 24)
+
+// The ring holds a power of two number of samples, so wrapping around is a
+// mask.
 typedef struct bloop_delay_data {
     int ring_index;
+    int mask;
+    int max_delay;
     float *ring;
 } bloop_delay_data;
 
@@ -129,17 +232,60 @@ typedef struct bloop_offset_data {
     int offset;
 } bloop_offset_data;
 
-float bloop_sine_wave_(bloop_generator *g, void *value, int tick);
-float bloop_white_noise_(bloop_generator *g, void *value, int tick);
-float bloop_constant_(bloop_generator *g, void *value, int tick);
-float bloop_interpolation_(bloop_generator *g, void *value, int tick);
-float bloop_adsr_(bloop_generator *g, void *value, int tick);
-float bloop_lfo_(bloop_generator *g, void *value, int tick);
-float bloop_distortion_(bloop_generator *g, void *value, int tick);
-float bloop_delay_(bloop_generator *g, void *value, int tick);
-float bloop_repeat_(bloop_generator *g, void *value, int tick);
-float bloop_offset_(bloop_generator *g, void *value, int tick);
-float bloop_average_(bloop_generator *g, void *value, int tick);
+// ends[i] is the tick step i ends at, which is where step i + 1 starts.
+typedef struct bloop_sequence_data {
+    int count;
+    bloop_tick *ends;
+    int cursor;
+} bloop_sequence_data;
+
+// A parameter is a value that can be changed from another thread (e.g. the
+// UI) while the audio thread is running. The new value is stored atomically
+// in target, and the audio thread moves towards it with a one pole filter so
+// jumps don't click. Only the audio thread touches value.
+typedef struct bloop_param_data {
+    _Atomic float target;
+    float value;
+    float smoothing;
+    float min;
+    float max;
+} bloop_param_data;
+
+#define BLOOP_PARAM_EPSILON 1e-6f
+
+float bloop_sine_wave_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_white_noise_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_constant_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_interpolation_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_adsr_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_lfo_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_distortion_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_delay_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_repeat_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_offset_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_average_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_sequence_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_param_(bloop_generator *g, void *value, bloop_tick tick);
+
+void bloop_sine_wave_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_white_noise_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_interpolation_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_adsr_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_lfo_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_distortion_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_delay_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_average_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_param_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+
+int bloop_repeat_segment_(bloop_generator *g, void *value, bloop_tick tick, int n, int *input, bloop_tick *input_tick);
+int bloop_offset_segment_(bloop_generator *g, void *value, bloop_tick tick, int n, int *input, bloop_tick *input_tick);
+void bloop_sine_wave_constant_pitch_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_lfo_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_delay_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_distortion_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+
+int bloop_sequence_segment_(bloop_generator *g, void *value, bloop_tick tick, int n, int *input, bloop_tick *input_tick);
 
 bloop_generator *bloop_sine_wave(bloop_generator *pitch, bloop_generator *gain);
 bloop_generator *bloop_white_noise(bloop_generator *gain);
@@ -148,11 +294,41 @@ bloop_generator *bloop_interpolation(float from, float to, int over);
 bloop_generator *bloop_adsr(float max_gain, float sustain, int attack_samples, int decay_samples, int sustain_samples, int release_samples);
 bloop_generator *bloop_lfo(bloop_generator *speed, bloop_generator *offset, bloop_generator *amount);
 bloop_generator *bloop_distortion(bloop_generator *input, bloop_generator *level, bloop_generator *gain);
-bloop_generator *bloop_delay(bloop_generator *input, bloop_generator *delay_samples, bloop_generator *factor, bloop_generator *feedback);
+// delay_samples can have a fraction and is clamped to [1, max_delay_samples];
+// max_delay_samples is clamped to [1, BLOOP_MAX_DELAY].
+bloop_generator *bloop_delay(bloop_generator *input, bloop_generator *delay_samples, bloop_generator *factor, bloop_generator *feedback, int max_delay_samples);
+// Clamps *max_delay_samples to [1, BLOOP_MAX_DELAY] and returns the size of
+// a ring for it: a power of 2 with room for the longest delay, the sample
+// after it for interpolation and the sample that is being written.
+int bloop_delay_ring_size(int *max_delay_samples);
 bloop_generator *bloop_repeat(bloop_generator *input, int every);
 bloop_generator *bloop_offset(bloop_generator *input, int offset);
 bloop_generator *bloop_average(int count, ...);
+bloop_generator *bloop_average_array(int count, bloop_generator **inputs);
+// Plays count steps one after another, each for its number of ticks, e.g.
+// bloop_sequence(2, kick, 22050, snare, 22050).
 bloop_generator *bloop_sequence(int count, ...);
+bloop_generator *bloop_sequence_array(int count, bloop_generator **steps, int *lengths);
+// smoothing_samples is the time constant of the smoothing; 0 jumps right away.
+// The value is kept in [min, max], here and in bloop_param_set.
+bloop_generator *bloop_param(float value, float min, float max, int smoothing_samples);
+
+// Safe to call from any thread while the audio thread is running.
+void bloop_param_set(bloop_generator *g, float value);
+float bloop_param_get(bloop_generator *g);
+
+// Puts g and its inputs back in the state they were created in, so the graph
+// can be played again from tick 0. Doesn't allocate.
+void bloop_reset(bloop_generator *g);
+
+// Frees what g and its inputs hold outside of their arena, e.g. the plans of
+// voices, before the arena is freed. Generators that are shared are only
+// freed once.
+void bloop_free_graph(bloop_generator *g);
+
+// Fold subtrees that only depend on constants into constants, and switch
+// generators with constant inputs to specialised block functions.
+void bloop_optimize(bloop_generator *g);
 
 // Calculate the x,y for each generator.
 void bloop_calculate_layout(bloop_generator *g);
@@ -0,0 +1,589 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "convolution.h"
+#include "arena.h"
+#include "fastmath.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define BLOOP_NO_THREADS
+#endif
+#if defined(_WIN32)
+#define BLOOP_NO_THREADS
+#endif
+
+#ifndef BLOOP_NO_THREADS
+#include <pthread.h>
+#include <sched.h>
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+#endif
+
+extern int SAMPLE_RATE;
+
+static void bloop_fft_init(bloop_fft *f, int size) {
+    int m = size / 2;
+    int bits = 0;
+    while ((1 << bits) < m) {
+        bits++;
+    }
+    f->size = size;
+    // Rows are padded to whole AVX2 vectors, which stay zero.
+    f->stride = (m + 1 + 7) & ~7;
+    f->stage_re = bloop_alloc(sizeof(float) * m);
+    f->stage_im = bloop_alloc(sizeof(float) * m);
+    for (int h = 1; h < m; h *= 2) {
+        for (int j = 0; j < h; j++) {
+            f->stage_re[h - 1 + j] = (float) cos(M_PI * j / h);
+            f->stage_im[h - 1 + j] = (float) -sin(M_PI * j / h);
+        }
+    }
+    f->split_re = bloop_alloc(sizeof(float) * (m / 2 + 1));
+    f->split_im = bloop_alloc(sizeof(float) * (m / 2 + 1));
+    for (int k = 0; k <= m / 2; k++) {
+        f->split_re[k] = (float) cos(2.0 * M_PI * k / size);
+        f->split_im[k] = (float) -sin(2.0 * M_PI * k / size);
+    }
+    f->reverse = bloop_alloc(sizeof(int) * m);
+    for (int k = 0; k < m; k++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((k >> b) & 1) << (bits - 1 - b);
+        }
+        f->reverse[k] = r;
+    }
+}
+
+// The butterflies of a complex FFT of size / 2 points, in place, from
+// bit reversed input to output in order. Every butterfly of a stage uses a
+// different twiddle, so the butterflies of a group are vectorized.
+static void bloop_fft_stages(const bloop_fft *f, float *re, float *im) {
+    int m = f->size / 2;
+    for (int h = 1; h < m; h *= 2) {
+        const float *wr = f->stage_re + h - 1;
+        const float *wi = f->stage_im + h - 1;
+        for (int s = 0; s < m; s += 2 * h) {
+            float *ar = re + s;
+            float *ai = im + s;
+            float *br = re + s + h;
+            float *bi = im + s + h;
+            int j = 0;
+#if defined(__AVX2__)
+            for (; j + 8 <= h; j += 8) {
+                __m256 xr = _mm256_loadu_ps(br + j);
+                __m256 xi = _mm256_loadu_ps(bi + j);
+                __m256 cr = _mm256_loadu_ps(wr + j);
+                __m256 ci = _mm256_loadu_ps(wi + j);
+                __m256 tr = _mm256_sub_ps(_mm256_mul_ps(xr, cr), _mm256_mul_ps(xi, ci));
+                __m256 ti = _mm256_add_ps(_mm256_mul_ps(xr, ci), _mm256_mul_ps(xi, cr));
+                __m256 yr = _mm256_loadu_ps(ar + j);
+                __m256 yi = _mm256_loadu_ps(ai + j);
+                _mm256_storeu_ps(br + j, _mm256_sub_ps(yr, tr));
+                _mm256_storeu_ps(bi + j, _mm256_sub_ps(yi, ti));
+                _mm256_storeu_ps(ar + j, _mm256_add_ps(yr, tr));
+                _mm256_storeu_ps(ai + j, _mm256_add_ps(yi, ti));
+            }
+#endif
+#if defined(__SSE2__)
+            for (; j + 4 <= h; j += 4) {
+                __m128 xr = _mm_loadu_ps(br + j);
+                __m128 xi = _mm_loadu_ps(bi + j);
+                __m128 cr = _mm_loadu_ps(wr + j);
+                __m128 ci = _mm_loadu_ps(wi + j);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+                __m128 yr = _mm_loadu_ps(ar + j);
+                __m128 yi = _mm_loadu_ps(ai + j);
+                _mm_storeu_ps(br + j, _mm_sub_ps(yr, tr));
+                _mm_storeu_ps(bi + j, _mm_sub_ps(yi, ti));
+                _mm_storeu_ps(ar + j, _mm_add_ps(yr, tr));
+                _mm_storeu_ps(ai + j, _mm_add_ps(yi, ti));
+            }
+#endif
+            for (; j < h; j++) {
+                float tr = br[j] * wr[j] - bi[j] * wi[j];
+                float ti = br[j] * wi[j] + bi[j] * wr[j];
+                br[j] = ar[j] - tr;
+                bi[j] = ai[j] - ti;
+                ar[j] += tr;
+                ai[j] += ti;
+            }
+        }
+    }
+}
+
+// The spectrum of size real samples: the even samples go into the real
+// parts and the odd ones into the imaginary parts of a complex FFT, whose
+// output is then split into the spectra of the even and odd samples and
+// combined.
+static void bloop_fft_forward(const bloop_fft *f, const float *x, float *re, float *im) {
+    int m = f->size / 2;
+    for (int k = 0; k < m; k++) {
+        int r = f->reverse[k];
+        re[k] = x[2 * r];
+        im[k] = x[2 * r + 1];
+    }
+    bloop_fft_stages(f, re, im);
+
+    float a = re[0];
+    float b = im[0];
+    re[0] = a + b;
+    im[0] = 0.0f;
+    re[m] = a - b;
+    im[m] = 0.0f;
+    for (int k = 1; k <= m / 2; k++) {
+        int l = m - k;
+        a = re[k];
+        b = im[k];
+        float c = re[l];
+        float d = im[l];
+        float wr = f->split_re[k];
+        float wi = f->split_im[k];
+        float even_r = 0.5f * (a + c);
+        float even_i = 0.5f * (b - d);
+        float odd_r = 0.5f * (b + d);
+        float odd_i = 0.5f * (c - a);
+        float p = wr * odd_r - wi * odd_i;
+        float q = wr * odd_i + wi * odd_r;
+        re[k] = even_r + p;
+        im[k] = even_i + q;
+        re[l] = even_r - p;
+        im[l] = q - even_i;
+    }
+}
+
+// The size real samples of a spectrum, times size; overwrites the spectrum.
+// The inverse complex FFT is the forward one with the real and imaginary
+// parts swapped.
+static void bloop_fft_inverse(const bloop_fft *f, float *re, float *im, float *x) {
+    int m = f->size / 2;
+    float a = re[0];
+    float c = re[m];
+    re[0] = a + c;
+    im[0] = a - c;
+    for (int k = 1; k <= m / 2; k++) {
+        int l = m - k;
+        a = re[k];
+        float b = im[k];
+        c = re[l];
+        float d = im[l];
+        float wr = f->split_re[k];
+        float wi = f->split_im[k];
+        float even_r = a + c;
+        float even_i = b - d;
+        float dr = a - c;
+        float di = b + d;
+        float odd_r = dr * wr + di * wi;
+        float odd_i = di * wr - dr * wi;
+        re[k] = even_r - odd_i;
+        im[k] = even_i + odd_r;
+        re[l] = even_r + odd_i;
+        im[l] = odd_r - even_i;
+    }
+    for (int k = 0; k < m; k++) {
+        int r = f->reverse[k];
+        if (k < r) {
+            float t = re[k];
+            re[k] = re[r];
+            re[r] = t;
+            t = im[k];
+            im[k] = im[r];
+            im[r] = t;
+        }
+    }
+    bloop_fft_stages(f, im, re);
+    for (int k = 0; k < m; k++) {
+        x[2 * k] = re[k];
+        x[2 * k + 1] = im[k];
+    }
+}
+
+// sum += x * h for n bins, a multiple of 8.
+static void bloop_spectrum_mac(float *sum_re, float *sum_im, const float *x_re, const float *x_im, const float *h_re, const float *h_im, int n) {
+    int j = 0;
+#if defined(__AVX2__)
+    for (; j < n; j += 8) {
+        __m256 xr = _mm256_loadu_ps(x_re + j);
+        __m256 xi = _mm256_loadu_ps(x_im + j);
+        __m256 hr = _mm256_loadu_ps(h_re + j);
+        __m256 hi = _mm256_loadu_ps(h_im + j);
+        __m256 product_r = _mm256_sub_ps(_mm256_mul_ps(xr, hr), _mm256_mul_ps(xi, hi));
+        __m256 product_i = _mm256_add_ps(_mm256_mul_ps(xr, hi), _mm256_mul_ps(xi, hr));
+        _mm256_storeu_ps(sum_re + j, _mm256_add_ps(_mm256_loadu_ps(sum_re + j), product_r));
+        _mm256_storeu_ps(sum_im + j, _mm256_add_ps(_mm256_loadu_ps(sum_im + j), product_i));
+    }
+#elif defined(__SSE2__)
+    for (; j < n; j += 4) {
+        __m128 xr = _mm_loadu_ps(x_re + j);
+        __m128 xi = _mm_loadu_ps(x_im + j);
+        __m128 hr = _mm_loadu_ps(h_re + j);
+        __m128 hi = _mm_loadu_ps(h_im + j);
+        __m128 product_r = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+        __m128 product_i = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+        _mm_storeu_ps(sum_re + j, _mm_add_ps(_mm_loadu_ps(sum_re + j), product_r));
+        _mm_storeu_ps(sum_im + j, _mm_add_ps(_mm_loadu_ps(sum_im + j), product_i));
+    }
+#endif
+    for (; j < n; j++) {
+        float product_r = x_re[j] * h_re[j] - x_im[j] * h_im[j];
+        float product_i = x_re[j] * h_im[j] + x_im[j] * h_re[j];
+        sum_re[j] += product_r;
+        sum_im[j] += product_i;
+    }
+}
+
+// Splits length samples of ir into partitions of size samples.
+static void bloop_partitions_init(bloop_partitions *p, int size, const float *ir, int length) {
+    p->size = size;
+    p->count = length > 0 ? (length + size - 1) / size : 0;
+    p->current = 0;
+    if (p->count == 0) {
+        return;
+    }
+    bloop_fft_init(&p->fft, 2 * size);
+    int row = 2 * p->fft.stride;
+    p->ir = bloop_calloc((size_t) p->count * row, sizeof(float));
+    p->spectra = bloop_calloc((size_t) p->count * row, sizeof(float));
+    p->sum = bloop_calloc(row, sizeof(float));
+    p->time = bloop_calloc(2 * size, sizeof(float));
+    float scale = 1.0f / (2 * size);
+    for (int k = 0; k < p->count; k++) {
+        int n = length - k * size < size ? length - k * size : size;
+        memset(p->time, 0, sizeof(float) * 2 * size);
+        for (int i = 0; i < n; i++) {
+            p->time[i] = ir[k * size + i] * scale;
+        }
+        float *h = p->ir + (size_t) k * row;
+        bloop_fft_forward(&p->fft, p->time, h, h + p->fft.stride);
+    }
+}
+
+static void bloop_partitions_clear(bloop_partitions *p) {
+    if (p->count > 0) {
+        memset(p->spectra, 0, sizeof(float) * p->count * 2 * p->fft.stride);
+    }
+    p->current = 0;
+}
+
+// Convolves the frame of input in the second half of in (the first half is
+// the frame before) and writes size samples of output.
+static void bloop_partitions_run(bloop_partitions *p, const float *in, float *out) {
+    int stride = p->fft.stride;
+    int row = 2 * stride;
+    float *x = p->spectra + (size_t) p->current * row;
+    bloop_fft_forward(&p->fft, in, x, x + stride);
+
+    memset(p->sum, 0, sizeof(float) * row);
+    int slot = p->current;
+    for (int k = 0; k < p->count; k++) {
+        const float *s = p->spectra + (size_t) slot * row;
+        const float *h = p->ir + (size_t) k * row;
+        bloop_spectrum_mac(p->sum, p->sum + stride, s, s + stride, h, h + stride, stride);
+        slot = slot == 0 ? p->count - 1 : slot - 1;
+    }
+    bloop_fft_inverse(&p->fft, p->sum, p->sum + stride, p->time);
+    // The first half wrapped around.
+    memcpy(out, p->time + p->size, sizeof(float) * p->size);
+    p->current = p->current + 1 == p->count ? 0 : p->current + 1;
+}
+
+static void bloop_convolution_wake(void);
+
+// Convolves the tail frame in flight, unless someone else got to it first.
+static void bloop_convolution_run_job(bloop_convolution_data *data) {
+    int expected = BLOOP_CONVOLUTION_PENDING;
+    if (atomic_compare_exchange_strong_explicit(&data->job, &expected, BLOOP_CONVOLUTION_RUNNING, memory_order_acquire, memory_order_relaxed)) {
+        bloop_partitions_run(&data->tail, data->tail_job, data->tail_done);
+        atomic_store_explicit(&data->job, BLOOP_CONVOLUTION_DONE, memory_order_release);
+    }
+}
+
+// Waits for the tail frame in flight, convolving it here if the tail thread
+// hasn't started on it.
+static void bloop_convolution_wait(bloop_convolution_data *data) {
+    bloop_convolution_run_job(data);
+    while (atomic_load_explicit(&data->job, memory_order_acquire) == BLOOP_CONVOLUTION_RUNNING) {
+#ifndef BLOOP_NO_THREADS
+        sched_yield();
+#endif
+    }
+}
+
+// A tail frame of input is complete: the output of the frame before it is
+// played from now on, and this one goes to the tail thread.
+static void bloop_convolution_next_tail(bloop_convolution_data *data) {
+    int t = BLOOP_CONVOLUTION_TAIL;
+    if (atomic_load_explicit(&data->job, memory_order_relaxed) != BLOOP_CONVOLUTION_IDLE) {
+        bloop_convolution_wait(data);
+        memcpy(data->tail_out, data->tail_done, sizeof(float) * t);
+    }
+    memcpy(data->tail_job, data->tail_in, sizeof(float) * 2 * t);
+    atomic_store_explicit(&data->job, BLOOP_CONVOLUTION_PENDING, memory_order_release);
+    bloop_convolution_wake();
+    memcpy(data->tail_in, data->tail_in + t, sizeof(float) * t);
+}
+
+void bloop_convolution_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_convolution_data *data = (bloop_convolution_data *) value;
+    float *input = inputs[BLOOP_CONVOLUTION_INPUT];
+    float *mix = inputs[BLOOP_CONVOLUTION_MIX];
+    int h = BLOOP_CONVOLUTION_HEAD;
+    int t = BLOOP_CONVOLUTION_TAIL;
+
+    float x[BLOOP_CONVOLUTION_HEAD + BLOOP_MAX_BLOCK];
+    float wet[BLOOP_MAX_BLOCK];
+    memcpy(x, data->history, sizeof(float) * h);
+    memcpy(x + h, input, sizeof(float) * n);
+    bloop_fir_block(data->fir, h, x + h, wet, n);
+    memcpy(data->history, x + n, sizeof(float) * h);
+
+    // Up to the end of every head frame, add the partitioned parts and pass
+    // the input on to them.
+    for (int i = 0; i < n;) {
+        int offset = data->position % h;
+        int count = n - i < h - offset ? n - i : h - offset;
+        const float *head = data->head_out + offset;
+        const float *tail = data->tail_out + data->position;
+        for (int j = 0; j < count; j++) {
+            wet[i + j] += head[j] + tail[j];
+        }
+        memcpy(data->head_in + h + offset, input + i, sizeof(float) * count);
+        memcpy(data->tail_in + t + data->position, input + i, sizeof(float) * count);
+        data->position += count;
+        i += count;
+        if (offset + count == h && data->head.count > 0) {
+            bloop_partitions_run(&data->head, data->head_in, data->head_out);
+            memcpy(data->head_in, data->head_in + h, sizeof(float) * h);
+        }
+        if (data->position == t) {
+            data->position = 0;
+            if (data->tail.count > 0) {
+                bloop_convolution_next_tail(data);
+            }
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        out[i] = input[i] + mix[i] * (wet[i] - input[i]);
+    }
+}
+
+float bloop_convolution_(bloop_generator *g, void *value, bloop_tick tick) {
+    float input = bloop_run_input(g, BLOOP_CONVOLUTION_INPUT, tick);
+    float mix = bloop_run_input(g, BLOOP_CONVOLUTION_MIX, tick);
+    float *inputs[] = { &input, &mix };
+    float out;
+    bloop_convolution_block_(g, value, inputs, &out, 1, tick);
+    return out;
+}
+
+
+
+// The convolutions the tail thread looks after. Only touched with the lock
+// held; the audio thread never takes it.
+static struct {
+    bloop_convolution_data **convolutions;
+    int count;
+    int capacity;
+    atomic_int running;
+#ifndef BLOOP_NO_THREADS
+    pthread_mutex_t lock;
+    pthread_t thread;
+#ifdef __APPLE__
+    dispatch_semaphore_t wake;
+#else
+    sem_t wake;
+#endif
+#endif
+} bloop_tail = {
+#ifndef BLOOP_NO_THREADS
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+static void bloop_tail_lock(void) {
+#ifndef BLOOP_NO_THREADS
+    pthread_mutex_lock(&bloop_tail.lock);
+#endif
+}
+
+static void bloop_tail_unlock(void) {
+#ifndef BLOOP_NO_THREADS
+    pthread_mutex_unlock(&bloop_tail.lock);
+#endif
+}
+
+// Posting the semaphore doesn't block, so the audio thread can do it.
+static void bloop_convolution_wake(void) {
+#ifndef BLOOP_NO_THREADS
+    if (atomic_load_explicit(&bloop_tail.running, memory_order_relaxed)) {
+#ifdef __APPLE__
+        dispatch_semaphore_signal(bloop_tail.wake);
+#else
+        sem_post(&bloop_tail.wake);
+#endif
+    }
+#endif
+}
+
+// Takes a convolution off the tail thread. The thread convolves with the
+// lock held, so once this returns it's done with data.
+static void bloop_convolution_release(void *data) {
+    bloop_tail_lock();
+    for (int i = 0; i < bloop_tail.count; i++) {
+        if (bloop_tail.convolutions[i] == data) {
+            bloop_tail.convolutions[i] = bloop_tail.convolutions[--bloop_tail.count];
+            break;
+        }
+    }
+    bloop_tail_unlock();
+}
+
+bloop_generator *bloop_convolution(bloop_generator *input, const float *ir, int length, bloop_generator *mix) {
+    int h = BLOOP_CONVOLUTION_HEAD;
+    int t = BLOOP_CONVOLUTION_TAIL;
+    bloop_convolution_data *v = bloop_alloc(sizeof(*v));
+    v->length = length;
+    v->fir = bloop_calloc(h, sizeof(float));
+    memcpy(v->fir, ir, sizeof(float) * (length < h ? length : h));
+    v->history = bloop_calloc(h, sizeof(float));
+    v->position = 0;
+
+    int head_length = (length < 2 * t ? length : 2 * t) - h;
+    bloop_partitions_init(&v->head, h, head_length > 0 ? ir + h : ir, head_length);
+    v->head_in = bloop_calloc(2 * h, sizeof(float));
+    v->head_out = bloop_calloc(h, sizeof(float));
+    bloop_partitions_init(&v->tail, t, length > 2 * t ? ir + 2 * t : ir, length - 2 * t);
+    v->tail_in = bloop_calloc(2 * t, sizeof(float));
+    v->tail_out = bloop_calloc(t, sizeof(float));
+    v->tail_job = bloop_calloc(2 * t, sizeof(float));
+    v->tail_done = bloop_calloc(t, sizeof(float));
+    atomic_init(&v->job, BLOOP_CONVOLUTION_IDLE);
+
+    bloop_generator *g = bloop_new_generator(bloop_convolution_, BLOOP_CONVOLUTION, "CONVOLUTION", v);
+    g->block_fn = bloop_convolution_block_;
+    bloop_set_input_count(g, 2);
+    bloop_set_generator_input(BLOOP_CONVOLUTION_INPUT, g, input, "input");
+    bloop_set_generator_input(BLOOP_CONVOLUTION_MIX, g, mix, "mix");
+
+    if (v->tail.count > 0) {
+        bloop_tail_lock();
+        if (bloop_tail.count == bloop_tail.capacity) {
+            bloop_tail.capacity = bloop_tail.capacity == 0 ? 16 : bloop_tail.capacity * 2;
+            bloop_tail.convolutions = realloc(bloop_tail.convolutions, sizeof(bloop_convolution_data *) * bloop_tail.capacity);
+        }
+        bloop_tail.convolutions[bloop_tail.count++] = v;
+        bloop_tail_unlock();
+        bloop_on_free(bloop_convolution_release, v);
+    }
+    return g;
+}
+
+bloop_generator *bloop_convolution_file(bloop_generator *input, bloop_sample_file *file, bloop_generator *mix) {
+    // Resampled by linear interpolation, like a sample played at its own
+    // pitch; the taps are scaled so the level stays the same.
+    double step = (double) file->rate / SAMPLE_RATE;
+    int length = (int) ceil(file->frames / step);
+    float *ir = malloc(sizeof(float) * (length > 0 ? length : 1));
+    for (int i = 0; i < length; i++) {
+        double position = i * step;
+        int64_t frame = (int64_t) floor(position);
+        float fraction = (float)(position - frame);
+        float a = bloop_sample_frame(file, frame);
+        float b = bloop_sample_frame(file, frame + 1);
+        ir[i] = (a + fraction * (b - a)) * (float) step;
+    }
+    bloop_generator *g = bloop_convolution(input, ir, length, mix);
+    free(ir);
+    return g;
+}
+
+void bloop_convolution_free(bloop_generator *g) {
+    bloop_convolution_release(g->userData);
+}
+
+void bloop_convolution_clear(bloop_generator *g) {
+    bloop_convolution_data *data = (bloop_convolution_data *) g->userData;
+    int t = BLOOP_CONVOLUTION_TAIL;
+    bloop_convolution_wait(data);
+    atomic_store_explicit(&data->job, BLOOP_CONVOLUTION_IDLE, memory_order_relaxed);
+    memset(data->history, 0, sizeof(float) * BLOOP_CONVOLUTION_HEAD);
+    memset(data->head_in, 0, sizeof(float) * 2 * BLOOP_CONVOLUTION_HEAD);
+    memset(data->head_out, 0, sizeof(float) * BLOOP_CONVOLUTION_HEAD);
+    memset(data->tail_in, 0, sizeof(float) * 2 * t);
+    memset(data->tail_out, 0, sizeof(float) * t);
+    bloop_partitions_clear(&data->head);
+    bloop_partitions_clear(&data->tail);
+    data->position = 0;
+}
+
+#ifdef BLOOP_NO_THREADS
+
+int bloop_convolution_start(void) {
+    return 0;
+}
+
+void bloop_convolution_stop(void) {
+}
+
+#else
+
+static void *bloop_convolution_thread(void *arg) {
+    while (1) {
+#ifdef __APPLE__
+        dispatch_semaphore_wait(bloop_tail.wake, DISPATCH_TIME_FOREVER);
+#else
+        sem_wait(&bloop_tail.wake);
+#endif
+        if (!atomic_load(&bloop_tail.running)) {
+            break;
+        }
+        bloop_tail_lock();
+        for (int i = 0; i < bloop_tail.count; i++) {
+            bloop_convolution_run_job(bloop_tail.convolutions[i]);
+        }
+        bloop_tail_unlock();
+    }
+    return NULL;
+}
+
+int bloop_convolution_start(void) {
+    if (atomic_load(&bloop_tail.running)) {
+        return 1;
+    }
+#ifdef __APPLE__
+    bloop_tail.wake = dispatch_semaphore_create(0);
+#else
+    sem_init(&bloop_tail.wake, 0, 0);
+#endif
+    atomic_store(&bloop_tail.running, 1);
+    if (pthread_create(&bloop_tail.thread, NULL, bloop_convolution_thread, NULL) != 0) {
+        atomic_store(&bloop_tail.running, 0);
+        return 0;
+    }
+    return 1;
+}
+
+void bloop_convolution_stop(void) {
+    if (!atomic_load(&bloop_tail.running)) {
+        return;
+    }
+    atomic_store(&bloop_tail.running, 0);
+#ifdef __APPLE__
+    dispatch_semaphore_signal(bloop_tail.wake);
+#else
+    sem_post(&bloop_tail.wake);
+#endif
+    pthread_join(bloop_tail.thread, NULL);
+}
+
+#endif
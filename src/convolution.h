@@ -0,0 +1,135 @@
+#ifndef BLOOP_CONVOLUTION_H
+#define BLOOP_CONVOLUTION_H
+
+#include <stdatomic.h>
+#include "bloop.h"
+#include "sample.h"
+
+/*
+ * Convolution reverb: the input convolved with a recorded impulse response,
+ * e.g. of a room, mixed with the dry input:
+ *
+ *     bloop_sample_file *room = bloop_sample_open("room.wav");
+ *     bloop_generator *g = bloop_convolution_file(kick, room, C(0.3));
+ *     bloop_sample_close(room);
+ *
+ * The impulse response is split into three parts, each convolved in its own
+ * way, so the output has no latency while long responses stay cheap:
+ *
+ *   - the first BLOOP_CONVOLUTION_HEAD samples are a plain FIR filter, which
+ *     takes care of the samples that are needed right away;
+ *   - the rest of the first 2 * BLOOP_CONVOLUTION_TAIL samples is split into
+ *     partitions of BLOOP_CONVOLUTION_HEAD samples, convolved with FFTs of
+ *     twice that size every BLOOP_CONVOLUTION_HEAD samples of input;
+ *   - the remaining tail is split into partitions of BLOOP_CONVOLUTION_TAIL
+ *     samples, convolved on the tail thread (see bloop_convolution_start)
+ *     every BLOOP_CONVOLUTION_TAIL samples. The output of a frame of input
+ *     isn't needed until a frame later, so the tail thread has a whole frame
+ *     to compute it.
+ *
+ * Both partitioned parts are uniformly partitioned overlap-save convolutions:
+ * the spectrum of every frame of input goes into a delay line of spectra, and
+ * a frame of output is the inverse FFT of the sum of those spectra, each
+ * multiplied by the spectrum of its partition of the impulse response.
+ *
+ * Without the tail thread (or when it falls behind) the audio thread
+ * convolves the tail itself; either way the output is the same.
+ *
+ * The convolution carries on across ticks like a delay line: a reverb keeps
+ * ringing when a sequence starts again.
+ */
+
+#define BLOOP_CONVOLUTION_INPUT 0
+#define BLOOP_CONVOLUTION_MIX 1
+
+// Partition sizes, powers of 2. BLOOP_CONVOLUTION_TAIL is a multiple of
+// BLOOP_CONVOLUTION_HEAD.
+#define BLOOP_CONVOLUTION_HEAD 64
+#define BLOOP_CONVOLUTION_TAIL 1024
+
+// A real FFT of size samples, computed as a complex FFT of half the size.
+// Spectra are kept as separate rows of real and imaginary parts, of size / 2
+// + 1 bins padded to stride floats.
+typedef struct bloop_fft {
+    int size;
+    int stride;
+    // Twiddles of the complex stages: stage s (of half size h = 2^s) uses
+    // the h entries from h - 1 on.
+    float *stage_re;
+    float *stage_im;
+    // Twiddles that split the complex spectrum into the real one.
+    float *split_re;
+    float *split_im;
+    int *reverse;
+} bloop_fft;
+
+// A uniformly partitioned convolution with partitions (and frames) of size
+// samples.
+typedef struct bloop_partitions {
+    int size;
+    int count;
+    bloop_fft fft;
+    // count spectra of 2 * stride floats each, scaled by 1 / (2 * size).
+    float *ir;
+    // The spectra of the last count frames of input, newest at current.
+    float *spectra;
+    int current;
+    float *sum;
+    float *time;
+} bloop_partitions;
+
+enum bloop_convolution_job {
+    BLOOP_CONVOLUTION_IDLE,
+    BLOOP_CONVOLUTION_PENDING,
+    BLOOP_CONVOLUTION_RUNNING,
+    BLOOP_CONVOLUTION_DONE,
+};
+
+typedef struct bloop_convolution_data {
+    int length;
+
+    // The first taps of the impulse response and the last inputs.
+    float *fir;
+    float *history;
+
+    // Samples into the current tail frame.
+    int position;
+
+    // The last two frames of input of each part, and the output of the head
+    // for the current head frame and the tail for the current tail frame.
+    bloop_partitions head;
+    float *head_in;
+    float *head_out;
+    bloop_partitions tail;
+    float *tail_in;
+    float *tail_out;
+
+    // A tail frame in flight: tail_job is its input and tail_done its
+    // output. Whoever moves job from PENDING to RUNNING convolves it.
+    float *tail_job;
+    float *tail_done;
+    atomic_int job;
+} bloop_convolution_data;
+
+float bloop_convolution_(bloop_generator *g, void *value, bloop_tick tick);
+void bloop_convolution_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+
+// mix goes from 0 (only the input) to 1 (only the reverb). The impulse
+// response is copied, so it can be freed right away.
+bloop_generator *bloop_convolution(bloop_generator *input, const float *ir, int length, bloop_generator *mix);
+// Reads the impulse response from a sample file, mixed down to mono and
+// resampled to the sample rate; the file can be closed right away.
+bloop_generator *bloop_convolution_file(bloop_generator *input, bloop_sample_file *file, bloop_generator *mix);
+// Takes g off the tail thread; the generator belongs to the arena it was
+// built in, and freeing that arena takes it off as well.
+void bloop_convolution_free(bloop_generator *g);
+
+// Clears the input of the convolution; see bloop_reset.
+void bloop_convolution_clear(bloop_generator *g);
+
+// Starts and stops the tail thread. Without it, the audio thread convolves
+// the tails, all at once every BLOOP_CONVOLUTION_TAIL samples.
+int bloop_convolution_start(void);
+void bloop_convolution_stop(void);
+
+#endif
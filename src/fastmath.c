@@ -0,0 +1,126 @@
+#include "fastmath.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+static int bloop_fast_sin_simd(const float *x, float *out, int n) {
+    const __m256 inv_two_pi = _mm256_set1_ps(BLOOP_INV_TWO_PI);
+    const __m256 magic = _mm256_set1_ps(BLOOP_ROUND_MAGIC);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 minus_half = _mm256_set1_ps(-0.5f);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 y = _mm256_mul_ps(_mm256_loadu_ps(x + i), inv_two_pi);
+        y = _mm256_sub_ps(y, _mm256_sub_ps(_mm256_add_ps(y, magic), magic));
+        y = _mm256_min_ps(y, _mm256_sub_ps(half, y));
+        y = _mm256_max_ps(y, _mm256_sub_ps(minus_half, y));
+        __m256 z = _mm256_mul_ps(y, y);
+        __m256 p = _mm256_set1_ps(BLOOP_SIN_C9);
+        p = _mm256_add_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(BLOOP_SIN_C7));
+        p = _mm256_add_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(BLOOP_SIN_C5));
+        p = _mm256_add_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(BLOOP_SIN_C3));
+        p = _mm256_add_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(BLOOP_SIN_C1));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(p, y));
+    }
+    return i;
+}
+
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+
+static int bloop_fast_sin_simd(const float *x, float *out, int n) {
+    const __m128 inv_two_pi = _mm_set1_ps(BLOOP_INV_TWO_PI);
+    const __m128 magic = _mm_set1_ps(BLOOP_ROUND_MAGIC);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 minus_half = _mm_set1_ps(-0.5f);
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 y = _mm_mul_ps(_mm_loadu_ps(x + i), inv_two_pi);
+        y = _mm_sub_ps(y, _mm_sub_ps(_mm_add_ps(y, magic), magic));
+        y = _mm_min_ps(y, _mm_sub_ps(half, y));
+        y = _mm_max_ps(y, _mm_sub_ps(minus_half, y));
+        __m128 z = _mm_mul_ps(y, y);
+        __m128 p = _mm_set1_ps(BLOOP_SIN_C9);
+        p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(BLOOP_SIN_C7));
+        p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(BLOOP_SIN_C5));
+        p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(BLOOP_SIN_C3));
+        p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(BLOOP_SIN_C1));
+        _mm_storeu_ps(out + i, _mm_mul_ps(p, y));
+    }
+    return i;
+}
+
+#else
+
+static int bloop_fast_sin_simd(const float *x, float *out, int n) {
+    return 0;
+}
+
+#endif
+
+void bloop_fast_sin_block(const float *x, float *out, int n) {
+    int i = bloop_fast_sin_simd(x, out, n);
+    for (; i < n; i++) {
+        out[i] = bloop_fast_sin(x[i]);
+    }
+}
+
+// Every coefficient is applied to four vectors of consecutive outputs at
+// once, so the additions don't have to wait for each other.
+void bloop_fir_block(const float *c, int taps, const float *x, float *out, int n) {
+    int j = 0;
+#if defined(__AVX2__)
+    for (; j + 32 <= n; j += 32) {
+        __m256 s0 = _mm256_setzero_ps();
+        __m256 s1 = _mm256_setzero_ps();
+        __m256 s2 = _mm256_setzero_ps();
+        __m256 s3 = _mm256_setzero_ps();
+        for (int i = 0; i < taps; i++) {
+            __m256 k = _mm256_set1_ps(c[i]);
+            const float *p = x + j - i;
+            s0 = _mm256_add_ps(s0, _mm256_mul_ps(k, _mm256_loadu_ps(p)));
+            s1 = _mm256_add_ps(s1, _mm256_mul_ps(k, _mm256_loadu_ps(p + 8)));
+            s2 = _mm256_add_ps(s2, _mm256_mul_ps(k, _mm256_loadu_ps(p + 16)));
+            s3 = _mm256_add_ps(s3, _mm256_mul_ps(k, _mm256_loadu_ps(p + 24)));
+        }
+        _mm256_storeu_ps(out + j, s0);
+        _mm256_storeu_ps(out + j + 8, s1);
+        _mm256_storeu_ps(out + j + 16, s2);
+        _mm256_storeu_ps(out + j + 24, s3);
+    }
+#endif
+#if defined(__SSE2__)
+    for (; j + 16 <= n; j += 16) {
+        __m128 s0 = _mm_setzero_ps();
+        __m128 s1 = _mm_setzero_ps();
+        __m128 s2 = _mm_setzero_ps();
+        __m128 s3 = _mm_setzero_ps();
+        for (int i = 0; i < taps; i++) {
+            __m128 k = _mm_set1_ps(c[i]);
+            const float *p = x + j - i;
+            s0 = _mm_add_ps(s0, _mm_mul_ps(k, _mm_loadu_ps(p)));
+            s1 = _mm_add_ps(s1, _mm_mul_ps(k, _mm_loadu_ps(p + 4)));
+            s2 = _mm_add_ps(s2, _mm_mul_ps(k, _mm_loadu_ps(p + 8)));
+            s3 = _mm_add_ps(s3, _mm_mul_ps(k, _mm_loadu_ps(p + 12)));
+        }
+        _mm_storeu_ps(out + j, s0);
+        _mm_storeu_ps(out + j + 4, s1);
+        _mm_storeu_ps(out + j + 8, s2);
+        _mm_storeu_ps(out + j + 12, s3);
+    }
+    for (; j + 4 <= n; j += 4) {
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 0; i < taps; i++) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(c[i]), _mm_loadu_ps(x + j - i)));
+        }
+        _mm_storeu_ps(out + j, sum);
+    }
+#endif
+    for (; j < n; j++) {
+        float sum = 0.0f;
+        for (int i = 0; i < taps; i++) {
+            sum += c[i] * x[j - i];
+        }
+        out[j] = sum;
+    }
+}
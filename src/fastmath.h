@@ -0,0 +1,56 @@
+#ifndef BLOOP_FASTMATH
+#define BLOOP_FASTMATH
+
+/*
+ * Fast single precision sine for oscillators.
+ *
+ * The argument is reduced to a quarter period and fed to a degree 9 odd
+ * minimax polynomial for sin(2*pi*y) on [-0.25, 0.25]. The absolute error,
+ * measured against double precision sin, is at most 4.5e-7 on
+ * [-2*pi, 2*pi] (2.3e-7 on [-pi, pi]); for larger arguments it grows with
+ * the resolution of the float argument itself, so oscillators keep their
+ * phase wrapped to [0, 2*pi).
+ *
+ * bloop_fast_sin and bloop_fast_sin_block perform exactly the same float
+ * operations, so the per-sample and block paths produce identical samples.
+ * The block version processes 8 (AVX2) or 4 (SSE2) samples at a time.
+ *
+ * bloop_fir_block is the FIR filter kernel of the oversampling filters and
+ * the convolution reverb.
+ */
+
+#define BLOOP_TWO_PI 6.28318530717958647692f
+#define BLOOP_INV_TWO_PI 0.159154943091895f
+// Adding and subtracting 1.5 * 2^23 rounds a float to the nearest integer.
+#define BLOOP_ROUND_MAGIC 12582912.0f
+
+#define BLOOP_SIN_C1 6.283185005187988f
+#define BLOOP_SIN_C3 -41.34165573120117f
+#define BLOOP_SIN_C5 81.60100555419922f
+#define BLOOP_SIN_C7 -76.5497817993164f
+#define BLOOP_SIN_C9 39.536712646484375f
+
+static inline float bloop_fast_sin(float x) {
+    float y = x * BLOOP_INV_TWO_PI;
+    y = y - ((y + BLOOP_ROUND_MAGIC) - BLOOP_ROUND_MAGIC);
+    float a = 0.5f - y;
+    y = y < a ? y : a;
+    float b = -0.5f - y;
+    y = y > b ? y : b;
+    float z = y * y;
+    float p = BLOOP_SIN_C9;
+    p = p * z + BLOOP_SIN_C7;
+    p = p * z + BLOOP_SIN_C5;
+    p = p * z + BLOOP_SIN_C3;
+    p = p * z + BLOOP_SIN_C1;
+    return p * y;
+}
+
+// x and out can be the same buffer.
+void bloop_fast_sin_block(const float *x, float *out, int n);
+
+// out[j] = sum of c[i] * x[j - i] for the taps coefficients, so x has to
+// start taps - 1 samples into its buffer.
+void bloop_fir_block(const float *c, int taps, const float *x, float *out, int n);
+
+#endif
@@ -0,0 +1,417 @@
+#include <math.h>
+#include <string.h>
+#include "fdn.h"
+#include "arena.h"
+#include "fastmath.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+extern int SAMPLE_RATE;
+
+// The shortest and longest line at size 1.0, in seconds.
+#define BLOOP_FDN_SHORTEST 0.013
+#define BLOOP_FDN_LONGEST 0.090
+
+// Adding and subtracting this flushes the network to zero once it gets this
+// quiet, before it turns into slow denormals.
+#define BLOOP_FDN_FLUSH 1e-18f
+
+// ln(1 / 1000), for 60 dB.
+#define BLOOP_FDN_LN_60DB -6.907755279f
+
+// The input goes into the lines and out of them with these signs, which
+// repeat every 4 lines; sign 2 also comes out of the Hadamard matrix.
+#define BLOOP_FDN_SIGN1(k) ((k) % 2 == 0 ? 1.0f : -1.0f)
+#define BLOOP_FDN_SIGN2(k) ((k) % 4 < 2 ? 1.0f : -1.0f)
+
+// The gain of every line for a decay time, so that every line loses the same
+// amount per second. The gains include the 1 / sqrt(lines) of the Hadamard
+// matrix, which the network leaves out.
+static void bloop_fdn_gains(const bloop_fdn_data *data, float decay, float *gains) {
+    decay = decay > BLOOP_FDN_MIN_DECAY ? decay : BLOOP_FDN_MIN_DECAY;
+    float per_sample = BLOOP_FDN_LN_60DB / (decay * SAMPLE_RATE);
+    float norm = 1.0f / sqrtf((float) data->lines);
+    for (int k = 0; k < data->lines; k++) {
+        gains[k] = norm * expf(per_sample * data->lengths[k]);
+    }
+}
+
+// The coefficient of the one pole damping filters for a cutoff in Hz.
+static float bloop_fdn_damping(float cutoff) {
+    float nyquist = 0.49f * SAMPLE_RATE;
+    cutoff = cutoff > 10.0f ? cutoff : 10.0f;
+    cutoff = cutoff < nyquist ? cutoff : nyquist;
+    return 1.0f - expf(-BLOOP_TWO_PI * cutoff / SAMPLE_RATE);
+}
+
+// How many of the next n samples can be read from every line and written to
+// them without wrapping around the end of a line.
+static int bloop_fdn_span(const bloop_fdn_data *data, int n) {
+    int size = data->mask + 1;
+    n = n < size - data->position ? n : size - data->position;
+    for (int k = 0; k < data->lines; k++) {
+        int from = (data->position - data->lengths[k]) & data->mask;
+        n = n < size - from ? n : size - from;
+    }
+    return n;
+}
+
+// Copies n samples between the lines, from or to the given position in
+// each of them, and the frame, which has lines floats per sample. Four lines
+// and four samples are moved at once, with a transpose.
+static void bloop_fdn_copy(bloop_fdn_data *data, const int *positions, int n, int to_frame) {
+    int lines = data->lines;
+    size_t size = (size_t) data->mask + 1;
+    for (int k = 0; k < lines; k += 4) {
+        float *line[4];
+        for (int j = 0; j < 4; j++) {
+            line[j] = data->buffer + (k + j) * size + positions[k + j];
+        }
+        int t = 0;
+#if defined(__SSE2__)
+        for (; t + 4 <= n; t += 4) {
+            float *f = data->frame + t * lines + k;
+            if (to_frame) {
+                __m128 a = _mm_loadu_ps(line[0] + t);
+                __m128 b = _mm_loadu_ps(line[1] + t);
+                __m128 c = _mm_loadu_ps(line[2] + t);
+                __m128 d = _mm_loadu_ps(line[3] + t);
+                _MM_TRANSPOSE4_PS(a, b, c, d);
+                _mm_storeu_ps(f, a);
+                _mm_storeu_ps(f + lines, b);
+                _mm_storeu_ps(f + 2 * lines, c);
+                _mm_storeu_ps(f + 3 * lines, d);
+            } else {
+                __m128 a = _mm_loadu_ps(f);
+                __m128 b = _mm_loadu_ps(f + lines);
+                __m128 c = _mm_loadu_ps(f + 2 * lines);
+                __m128 d = _mm_loadu_ps(f + 3 * lines);
+                _MM_TRANSPOSE4_PS(a, b, c, d);
+                _mm_storeu_ps(line[0] + t, a);
+                _mm_storeu_ps(line[1] + t, b);
+                _mm_storeu_ps(line[2] + t, c);
+                _mm_storeu_ps(line[3] + t, d);
+            }
+        }
+#endif
+        for (; t < n; t++) {
+            float *f = data->frame + t * lines + k;
+            for (int j = 0; j < 4; j++) {
+                if (to_frame) {
+                    f[j] = line[j][t];
+                } else {
+                    line[j][t] = f[j];
+                }
+            }
+        }
+    }
+}
+
+// The network for n samples of the frame: damps the line outputs, writes
+// the mix of them to wet and the feedback and input to the frame. gains and
+// damping move on by their step every sample (0 when they are constant).
+//
+// Within a block only the damping filters depend on the sample before, so
+// they are kept to a multiply and an add per sample. The inputs of the lines
+// are flushed every sample and the filters at the end.
+//
+// The Hadamard matrix is applied as a fast Walsh-Hadamard transform, its
+// butterflies spanning lines / 2 lines first and 1 line last. The vector
+// versions do the butterflies between vectors first, which leaves the sums
+// the output is made of in the first vector, and those within a vector with
+// shuffles, multiplying the differences by -1. That is exact, so every
+// version produces the same samples.
+#if defined(__AVX2__)
+
+// Damps 8 lines.
+static inline __m256 bloop_fdn_damp(__m256 s, const float *f, const float *g, __m256 c, __m256 d) {
+    __m256 y = _mm256_mul_ps(_mm256_loadu_ps(f), _mm256_loadu_ps(g));
+    return _mm256_add_ps(_mm256_mul_ps(s, c), _mm256_mul_ps(d, y));
+}
+
+// The butterflies within 8 lines, plus the input, into the frame.
+static inline void bloop_fdn_feed(float *f, __m256 a, __m256 x) {
+    const __m256 flush = _mm256_set1_ps(BLOOP_FDN_FLUSH);
+    const __m256 sign4 = _mm256_setr_ps(1.0f, 1.0f, 1.0f, 1.0f, -1.0f, -1.0f, -1.0f, -1.0f);
+    const __m256 sign2 = _mm256_setr_ps(1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f);
+    const __m256 sign1 = _mm256_setr_ps(1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f);
+    a = _mm256_add_ps(_mm256_permute2f128_ps(a, a, 0x01), _mm256_mul_ps(a, sign4));
+    a = _mm256_add_ps(_mm256_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 1, 0)), _mm256_mul_ps(_mm256_shuffle_ps(a, a, _MM_SHUFFLE(3, 2, 3, 2)), sign2));
+    a = _mm256_add_ps(_mm256_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 0, 0)), _mm256_mul_ps(_mm256_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 1, 1)), sign1));
+    a = _mm256_add_ps(a, x);
+    _mm256_storeu_ps(f, _mm256_sub_ps(_mm256_add_ps(a, flush), flush));
+}
+
+// vectors (1 or 2) is a constant where this is inlined.
+static inline void bloop_fdn_network_vectors(bloop_fdn_data *data, const float *input, float *wet, int n, const float *gains, int gain_step, const float *damping, int damping_step, int vectors) {
+    const __m256 flush = _mm256_set1_ps(BLOOP_FDN_FLUSH);
+    const __m256 sign2 = _mm256_setr_ps(1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, -1.0f, -1.0f);
+    const __m256 sign1 = _mm256_setr_ps(1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f);
+    __m256 s0 = _mm256_loadu_ps(data->damped);
+    __m256 s1 = vectors == 2 ? _mm256_loadu_ps(data->damped + 8) : _mm256_setzero_ps();
+    for (int t = 0; t < n; t++) {
+        float *f = data->frame + t * 8 * vectors;
+        const float *g = gains + t * gain_step;
+        float coefficient = damping[t * damping_step];
+        __m256 d = _mm256_set1_ps(coefficient);
+        __m256 c = _mm256_set1_ps(1.0f - coefficient);
+        __m256 x = _mm256_mul_ps(_mm256_set1_ps(input[t]), sign1);
+        s0 = bloop_fdn_damp(s0, f, g, c, d);
+        __m256 m0 = s0;
+        if (vectors == 2) {
+            s1 = bloop_fdn_damp(s1, f + 8, g + 8, c, d);
+            m0 = _mm256_add_ps(s0, s1);
+            bloop_fdn_feed(f + 8, _mm256_sub_ps(s0, s1), x);
+        }
+        __m256 o = _mm256_mul_ps(m0, sign2);
+        __m128 h = _mm_add_ps(_mm256_castps256_ps128(o), _mm256_extractf128_ps(o, 1));
+        h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+        h = _mm_add_ss(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 1, 1, 1)));
+        wet[t] = _mm_cvtss_f32(h);
+        bloop_fdn_feed(f, m0, x);
+    }
+    _mm256_storeu_ps(data->damped, _mm256_sub_ps(_mm256_add_ps(s0, flush), flush));
+    if (vectors == 2) {
+        _mm256_storeu_ps(data->damped + 8, _mm256_sub_ps(_mm256_add_ps(s1, flush), flush));
+    }
+}
+
+static void bloop_fdn_network(bloop_fdn_data *data, const float *input, float *wet, int n, const float *gains, int gain_step, const float *damping, int damping_step) {
+    if (data->lines == 16) {
+        bloop_fdn_network_vectors(data, input, wet, n, gains, gain_step, damping, damping_step, 2);
+    } else {
+        bloop_fdn_network_vectors(data, input, wet, n, gains, gain_step, damping, damping_step, 1);
+    }
+}
+
+#elif defined(__SSE2__)
+
+// Damps 4 lines.
+static inline __m128 bloop_fdn_damp(__m128 s, const float *f, const float *g, __m128 c, __m128 d) {
+    __m128 y = _mm_mul_ps(_mm_loadu_ps(f), _mm_loadu_ps(g));
+    return _mm_add_ps(_mm_mul_ps(s, c), _mm_mul_ps(d, y));
+}
+
+// The butterflies within 4 lines, plus the input, into the frame.
+static inline void bloop_fdn_feed(float *f, __m128 a, __m128 x) {
+    const __m128 flush = _mm_set1_ps(BLOOP_FDN_FLUSH);
+    const __m128 sign2 = _mm_setr_ps(1.0f, 1.0f, -1.0f, -1.0f);
+    const __m128 sign1 = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+    a = _mm_add_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 1, 0)), _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 2, 3, 2)), sign2));
+    a = _mm_add_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 0, 0)), _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 1, 1)), sign1));
+    a = _mm_add_ps(a, x);
+    _mm_storeu_ps(f, _mm_sub_ps(_mm_add_ps(a, flush), flush));
+}
+
+// vectors (2 or 4) is a constant where this is inlined.
+static inline void bloop_fdn_network_vectors(bloop_fdn_data *data, const float *input, float *wet, int n, const float *gains, int gain_step, const float *damping, int damping_step, int vectors) {
+    const __m128 flush = _mm_set1_ps(BLOOP_FDN_FLUSH);
+    const __m128 sign2 = _mm_setr_ps(1.0f, 1.0f, -1.0f, -1.0f);
+    const __m128 sign1 = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+    __m128 s[4];
+    for (int v = 0; v < 4; v++) {
+        s[v] = v < vectors ? _mm_loadu_ps(data->damped + 4 * v) : _mm_setzero_ps();
+    }
+    for (int t = 0; t < n; t++) {
+        float *f = data->frame + t * 4 * vectors;
+        const float *g = gains + t * gain_step;
+        float coefficient = damping[t * damping_step];
+        __m128 d = _mm_set1_ps(coefficient);
+        __m128 c = _mm_set1_ps(1.0f - coefficient);
+        __m128 x = _mm_mul_ps(_mm_set1_ps(input[t]), sign1);
+        s[0] = bloop_fdn_damp(s[0], f, g, c, d);
+        s[1] = bloop_fdn_damp(s[1], f + 4, g + 4, c, d);
+        __m128 m0 = s[0];
+        __m128 m1 = s[1];
+        if (vectors == 4) {
+            s[2] = bloop_fdn_damp(s[2], f + 8, g + 8, c, d);
+            s[3] = bloop_fdn_damp(s[3], f + 12, g + 12, c, d);
+            m0 = _mm_add_ps(s[0], s[2]);
+            m1 = _mm_add_ps(s[1], s[3]);
+            __m128 a2 = _mm_sub_ps(s[0], s[2]);
+            __m128 a3 = _mm_sub_ps(s[1], s[3]);
+            bloop_fdn_feed(f + 8, _mm_add_ps(a2, a3), x);
+            bloop_fdn_feed(f + 12, _mm_sub_ps(a2, a3), x);
+        }
+        __m128 a0 = m0;
+        m0 = _mm_add_ps(a0, m1);
+        m1 = _mm_sub_ps(a0, m1);
+        __m128 h = _mm_mul_ps(m0, sign2);
+        h = _mm_add_ps(h, _mm_movehl_ps(h, h));
+        h = _mm_add_ss(h, _mm_shuffle_ps(h, h, _MM_SHUFFLE(1, 1, 1, 1)));
+        wet[t] = _mm_cvtss_f32(h);
+        bloop_fdn_feed(f, m0, x);
+        bloop_fdn_feed(f + 4, m1, x);
+    }
+    for (int v = 0; v < vectors; v++) {
+        _mm_storeu_ps(data->damped + 4 * v, _mm_sub_ps(_mm_add_ps(s[v], flush), flush));
+    }
+}
+
+static void bloop_fdn_network(bloop_fdn_data *data, const float *input, float *wet, int n, const float *gains, int gain_step, const float *damping, int damping_step) {
+    if (data->lines == 16) {
+        bloop_fdn_network_vectors(data, input, wet, n, gains, gain_step, damping, damping_step, 4);
+    } else {
+        bloop_fdn_network_vectors(data, input, wet, n, gains, gain_step, damping, damping_step, 2);
+    }
+}
+
+#else
+
+static void bloop_fdn_network(bloop_fdn_data *data, const float *input, float *wet, int n, const float *gains, int gain_step, const float *damping, int damping_step) {
+    int lines = data->lines;
+    float *s = data->damped;
+    for (int t = 0; t < n; t++) {
+        float *f = data->frame + t * lines;
+        const float *g = gains + t * gain_step;
+        float d = damping[t * damping_step];
+        float c = 1.0f - d;
+        float m[BLOOP_FDN_MAX_LINES];
+        float o[BLOOP_FDN_MAX_LINES];
+        for (int k = 0; k < lines; k++) {
+            float y = f[k] * g[k];
+            s[k] = s[k] * c + d * y;
+            o[k] = s[k] * BLOOP_FDN_SIGN2(k);
+            m[k] = s[k];
+        }
+        for (int w = lines / 2; w >= 1; w /= 2) {
+            for (int k = 0; k < w; k++) {
+                o[k] += o[k + w];
+            }
+            for (int k = 0; k < lines; k++) {
+                if (!(k & w)) {
+                    float a = m[k];
+                    m[k] = a + m[k + w];
+                    m[k + w] = a - m[k + w];
+                }
+            }
+        }
+        wet[t] = o[0];
+        for (int k = 0; k < lines; k++) {
+            float a = m[k] + input[t] * BLOOP_FDN_SIGN1(k);
+            f[k] = (a + BLOOP_FDN_FLUSH) - BLOOP_FDN_FLUSH;
+        }
+    }
+    for (int k = 0; k < lines; k++) {
+        s[k] = (s[k] + BLOOP_FDN_FLUSH) - BLOOP_FDN_FLUSH;
+    }
+}
+
+#endif
+
+static void bloop_fdn_run(bloop_fdn_data *data, float **inputs, float *out, int n, const float *gains, int gain_step, const float *damping, int damping_step) {
+    float *input = inputs[BLOOP_FDN_INPUT];
+    float *mix = inputs[BLOOP_FDN_MIX];
+    float wet[BLOOP_MAX_BLOCK];
+    // The lines are read before they are written, so no more than the
+    // shortest line at a time.
+    for (int i = 0; i < n;) {
+        int count = bloop_fdn_span(data, n - i < data->shortest ? n - i : data->shortest);
+        int from[BLOOP_FDN_MAX_LINES];
+        int to[BLOOP_FDN_MAX_LINES];
+        for (int k = 0; k < data->lines; k++) {
+            from[k] = (data->position - data->lengths[k]) & data->mask;
+            to[k] = data->position;
+        }
+        bloop_fdn_copy(data, from, count, 1);
+        bloop_fdn_network(data, input + i, wet + i, count, gains + i * gain_step, gain_step, damping + i * damping_step, damping_step);
+        bloop_fdn_copy(data, to, count, 0);
+        data->position = (data->position + count) & data->mask;
+        i += count;
+    }
+    for (int i = 0; i < n; i++) {
+        out[i] = input[i] + mix[i] * (wet[i] - input[i]);
+    }
+}
+
+void bloop_fdn_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_fdn_data *data = (bloop_fdn_data *) value;
+    float *decay = inputs[BLOOP_FDN_DECAY];
+    float *damping = inputs[BLOOP_FDN_DAMPING];
+    for (int i = 0; i < n; i++) {
+        bloop_fdn_gains(data, decay[i], data->gains + i * data->lines);
+        data->damping[i] = bloop_fdn_damping(damping[i]);
+    }
+    bloop_fdn_run(data, inputs, out, n, data->gains, data->lines, data->damping, 1);
+}
+
+void bloop_fdn_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_fdn_data *data = (bloop_fdn_data *) value;
+    bloop_fdn_gains(data, inputs[BLOOP_FDN_DECAY][0], data->gains);
+    data->damping[0] = bloop_fdn_damping(inputs[BLOOP_FDN_DAMPING][0]);
+    bloop_fdn_run(data, inputs, out, n, data->gains, 0, data->damping, 0);
+}
+
+float bloop_fdn_(bloop_generator *g, void *value, bloop_tick tick) {
+    float input = bloop_run_input(g, BLOOP_FDN_INPUT, tick);
+    float decay = bloop_run_input(g, BLOOP_FDN_DECAY, tick);
+    float damping = bloop_run_input(g, BLOOP_FDN_DAMPING, tick);
+    float mix = bloop_run_input(g, BLOOP_FDN_MIX, tick);
+    float *inputs[] = { &input, &decay, &damping, &mix };
+    float out;
+    bloop_fdn_block_(g, value, inputs, &out, 1, tick);
+    return out;
+}
+
+static int bloop_is_prime(int n) {
+    for (int d = 2; d * d <= n; d++) {
+        if (n % d == 0) {
+            return 0;
+        }
+    }
+    return n >= 2;
+}
+
+bloop_generator *bloop_fdn(bloop_generator *input, bloop_generator *decay, bloop_generator *damping, bloop_generator *mix, int lines, float size) {
+    bloop_fdn_data *v = bloop_alloc(sizeof(*v));
+    v->lines = lines == 16 ? 16 : 8;
+    size = size > BLOOP_FDN_MIN_SIZE ? size : BLOOP_FDN_MIN_SIZE;
+    v->size = size < BLOOP_FDN_MAX_SIZE ? size : BLOOP_FDN_MAX_SIZE;
+    // Spaced evenly on a log scale; as the spacing is wider than 1, the
+    // lengths are all different primes.
+    double shortest = BLOOP_FDN_SHORTEST * SAMPLE_RATE * v->size;
+    double ratio = BLOOP_FDN_LONGEST / BLOOP_FDN_SHORTEST;
+    int longest = 0;
+    for (int k = 0; k < v->lines; k++) {
+        int length = (int) round(shortest * pow(ratio, (double) k / (v->lines - 1)));
+        length = length > 2 ? length : 2;
+        while (!bloop_is_prime(length)) {
+            length++;
+        }
+        v->lengths[k] = length;
+        longest = length > longest ? length : longest;
+        v->damped[k] = 0.0f;
+    }
+    v->shortest = v->lengths[0];
+
+    int size_samples = 1;
+    while (size_samples < longest + BLOOP_MAX_BLOCK) {
+        size_samples *= 2;
+    }
+    v->mask = size_samples - 1;
+    v->position = 0;
+    v->buffer = bloop_calloc((size_t) v->lines * size_samples, sizeof(float));
+    v->frame = bloop_alloc(sizeof(float) * v->lines * BLOOP_MAX_BLOCK);
+    v->gains = bloop_alloc(sizeof(float) * v->lines * BLOOP_MAX_BLOCK);
+    v->damping = bloop_alloc(sizeof(float) * BLOOP_MAX_BLOCK);
+
+    bloop_generator *g = bloop_new_generator(bloop_fdn_, BLOOP_FDN, "FDN", v);
+    g->block_fn = bloop_fdn_block_;
+    bloop_set_input_count(g, 4);
+    bloop_set_generator_input(BLOOP_FDN_INPUT, g, input, "input");
+    bloop_set_generator_input(BLOOP_FDN_DECAY, g, decay, "decay");
+    bloop_set_generator_input(BLOOP_FDN_DAMPING, g, damping, "damping");
+    bloop_set_generator_input(BLOOP_FDN_MIX, g, mix, "mix");
+    return g;
+}
+
+void bloop_fdn_clear(bloop_generator *g) {
+    bloop_fdn_data *data = (bloop_fdn_data *) g->userData;
+    memset(data->buffer, 0, sizeof(float) * data->lines * (data->mask + 1));
+    memset(data->damped, 0, sizeof(data->damped));
+    data->position = 0;
+}
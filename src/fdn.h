@@ -0,0 +1,75 @@
+#ifndef BLOOP_FDN_H
+#define BLOOP_FDN_H
+
+#include "bloop.h"
+
+/*
+ * An algorithmic reverb: a feedback delay network of 8 or 16 delay lines,
+ * e.g.
+ *
+ *     bloop_generator *g = bloop_fdn(voices, C(2.5), C(6000.0), C(0.3), 8, 1.0f);
+ *
+ * The output of every line goes through a one pole lowpass (the damping,
+ * which makes the highs die away first) and is fed back into all of the
+ * lines through a Hadamard matrix, together with the input. The gain of
+ * every line is set from its length, so that the reverb dies away by 60 dB
+ * in decay seconds.
+ *
+ * All of the lines are processed as one vector (two or four with SSE2, one
+ * or two with AVX2) per sample. The lines are longer than a block, so a
+ * block reads the outputs of the lines before it writes their inputs:
+ * the outputs of a whole block are copied into a frame, the network runs
+ * over the frame from sample to sample, and the frame is copied back into
+ * the lines.
+ *
+ * The line lengths are primes between 13 and 90 ms, scaled by size
+ * (BLOOP_FDN_MIN_SIZE to BLOOP_FDN_MAX_SIZE); size 2.0 is a hall twice as
+ * big.
+ */
+
+#define BLOOP_FDN_INPUT 0
+#define BLOOP_FDN_DECAY 1
+#define BLOOP_FDN_DAMPING 2
+#define BLOOP_FDN_MIX 3
+
+#define BLOOP_FDN_MAX_LINES 16
+#define BLOOP_FDN_MIN_DECAY 0.05f
+#define BLOOP_FDN_MIN_SIZE 0.1f
+#define BLOOP_FDN_MAX_SIZE 8.0f
+
+typedef struct bloop_fdn_data {
+    int lines;
+    float size;
+    int lengths[BLOOP_FDN_MAX_LINES];
+    int shortest;
+
+    // The lines have the same power of 2 size and share a write position.
+    float *buffer;
+    int mask;
+    int position;
+
+    // The state of the damping filters.
+    float damped[BLOOP_FDN_MAX_LINES];
+
+    // A block of line outputs, lines floats per sample, overwritten with
+    // the inputs of the lines.
+    float *frame;
+    // The gains of every line and the damping coefficient for every sample
+    // of a block.
+    float *gains;
+    float *damping;
+} bloop_fdn_data;
+
+float bloop_fdn_(bloop_generator *g, void *value, bloop_tick tick);
+void bloop_fdn_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_fdn_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+
+// decay is the time it takes to die away by 60 dB, in seconds, and damping
+// the cutoff of the damping filters in Hz. mix goes from 0 (only the input)
+// to 1 (only the reverb). lines is 8 or 16.
+bloop_generator *bloop_fdn(bloop_generator *input, bloop_generator *decay, bloop_generator *damping, bloop_generator *mix, int lines, float size);
+
+// Empties the lines; see bloop_reset.
+void bloop_fdn_clear(bloop_generator *g);
+
+#endif
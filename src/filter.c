@@ -0,0 +1,373 @@
+#include <math.h>
+#include <string.h>
+#include "filter.h"
+#include "arena.h"
+#include "fastmath.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+extern int SAMPLE_RATE;
+
+// Coefficient rows have room for a block and BLOOP_FILTER_PAD samples on
+// either side, which the lanes of stages that are idle read.
+#define BLOOP_FILTER_PAD 4
+#define BLOOP_FILTER_ROW (BLOOP_MAX_BLOCK + 2 * BLOOP_FILTER_PAD)
+
+#define BLOOP_BIQUAD_ROWS 5
+#define BLOOP_SVF_ROWS 6
+
+typedef float bloop_filter_rows[][BLOOP_FILTER_ROW];
+
+#define bloop_filter_row(rows, r) ((rows)[r] + BLOOP_FILTER_PAD)
+
+// sin and cos of cutoff * scale for n samples, with the cutoff kept below
+// half the sample rate.
+static void bloop_filter_angles(const float *cutoff, float scale, float *sn, float *cs, int n) {
+    float nyquist = 0.49f * SAMPLE_RATE;
+    for (int i = 0; i < n; i++) {
+        float f = cutoff[i] > 1.0f ? cutoff[i] : 1.0f;
+        sn[i] = (f < nyquist ? f : nyquist) * scale;
+        cs[i] = sn[i] + BLOOP_TWO_PI / 4.0f;
+    }
+    bloop_fast_sin_block(sn, sn, n);
+    bloop_fast_sin_block(cs, cs, n);
+}
+
+static void bloop_filter_pad(bloop_filter_rows rows, int count, int n) {
+    for (int r = 0; r < count; r++) {
+        memset(rows[r], 0, sizeof(float) * BLOOP_FILTER_PAD);
+        memset(rows[r] + BLOOP_FILTER_PAD + n, 0, sizeof(float) * BLOOP_FILTER_PAD);
+    }
+}
+
+// Repeats the coefficients of the first sample for all n.
+static void bloop_filter_fill(bloop_filter_rows rows, int count, int n) {
+    for (int r = 0; r < count; r++) {
+        float *row = bloop_filter_row(rows, r);
+        for (int i = 1; i < n; i++) {
+            row[i] = row[0];
+        }
+    }
+}
+
+#if defined(__SSE2__)
+// Lane k of the result is c[t - k], or 0 for lanes without a stage, which
+// then stay at rest.
+static inline __m128 bloop_filter_lanes(const float *c, int t, __m128 used) {
+    __m128 v = _mm_loadu_ps(c + t - 3);
+    return _mm_and_ps(_mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 1, 2, 3)), used);
+}
+
+static inline __m128 bloop_filter_used(int stages) {
+    return _mm_cmplt_ps(_mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f), _mm_set1_ps((float) stages));
+}
+
+// The previous outputs of every stage move to the next stage, and x goes
+// into the first.
+static inline __m128 bloop_filter_shift(__m128 y, float x) {
+    __m128 shifted = _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(y), 4));
+    return _mm_move_ss(shifted, _mm_set_ss(x));
+}
+
+// While the stages fill up (t < stages - 1) and empty out (t >= n) some of
+// them have no sample, and keep their state; in between all of them work.
+static inline int bloop_filter_edge(int t, int n, int stages) {
+    return t < stages - 1 || t >= n;
+}
+
+// The lanes working on a sample of this block at step t.
+static inline __m128 bloop_filter_active(int t, int n) {
+    __m128 sample = _mm_sub_ps(_mm_set1_ps((float) t), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+    return _mm_and_ps(_mm_cmpge_ps(sample, _mm_setzero_ps()), _mm_cmplt_ps(sample, _mm_set1_ps((float) n)));
+}
+
+static inline __m128 bloop_filter_select(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+
+
+// RBJ cookbook coefficients, normalized by a0: b0, b1, b2, a1, a2.
+static void bloop_biquad_coefficients(enum bloop_filter_mode mode, const float *cutoff, const float *resonance, bloop_filter_rows rows, int n) {
+    float sn[BLOOP_MAX_BLOCK];
+    float cs[BLOOP_MAX_BLOCK];
+    float *b0 = bloop_filter_row(rows, 0);
+    float *b1 = bloop_filter_row(rows, 1);
+    float *b2 = bloop_filter_row(rows, 2);
+    float *a1 = bloop_filter_row(rows, 3);
+    float *a2 = bloop_filter_row(rows, 4);
+    float inv[BLOOP_MAX_BLOCK];
+    bloop_filter_angles(cutoff, BLOOP_TWO_PI / SAMPLE_RATE, sn, cs, n);
+    // Separate loops for every mode, so they vectorize.
+    for (int i = 0; i < n; i++) {
+        float q = resonance[i] > BLOOP_FILTER_MIN_RESONANCE ? resonance[i] : BLOOP_FILTER_MIN_RESONANCE;
+        float alpha = sn[i] / (2.0f * q);
+        inv[i] = 1.0f / (1.0f + alpha);
+        a1[i] = -2.0f * cs[i] * inv[i];
+        a2[i] = (1.0f - alpha) * inv[i];
+        b0[i] = alpha * inv[i];
+    }
+    switch (mode) {
+        case BLOOP_LOWPASS:
+            for (int i = 0; i < n; i++) {
+                b1[i] = (1.0f - cs[i]) * inv[i];
+                b0[i] = b2[i] = 0.5f * b1[i];
+            }
+            break;
+        case BLOOP_HIGHPASS:
+            for (int i = 0; i < n; i++) {
+                b1[i] = -(1.0f + cs[i]) * inv[i];
+                b0[i] = b2[i] = -0.5f * b1[i];
+            }
+            break;
+        case BLOOP_BANDPASS:
+            for (int i = 0; i < n; i++) {
+                b1[i] = 0.0f;
+                b2[i] = -b0[i];
+            }
+            break;
+        case BLOOP_NOTCH:
+            for (int i = 0; i < n; i++) {
+                b0[i] = b2[i] = inv[i];
+                b1[i] = a1[i];
+            }
+            break;
+    }
+}
+
+static void bloop_biquad_run(bloop_biquad_data *data, bloop_filter_rows rows, const float *in, float *out, int n) {
+    const float *b0 = bloop_filter_row(rows, 0);
+    const float *b1 = bloop_filter_row(rows, 1);
+    const float *b2 = bloop_filter_row(rows, 2);
+    const float *a1 = bloop_filter_row(rows, 3);
+    const float *a2 = bloop_filter_row(rows, 4);
+    int stages = data->stages;
+#if defined(__SSE2__)
+    __m128 s1 = _mm_loadu_ps(data->s1);
+    __m128 s2 = _mm_loadu_ps(data->s2);
+    __m128 y = _mm_setzero_ps();
+    __m128 used = bloop_filter_used(stages);
+    float last[4];
+    for (int t = 0; t < n + stages - 1; t++) {
+        __m128 x = bloop_filter_shift(y, t < n ? in[t] : 0.0f);
+        y = _mm_add_ps(_mm_mul_ps(bloop_filter_lanes(b0, t, used), x), s1);
+        __m128 s1_next = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(bloop_filter_lanes(b1, t, used), x), s2), _mm_mul_ps(bloop_filter_lanes(a1, t, used), y));
+        __m128 s2_next = _mm_sub_ps(_mm_mul_ps(bloop_filter_lanes(b2, t, used), x), _mm_mul_ps(bloop_filter_lanes(a2, t, used), y));
+        if (bloop_filter_edge(t, n, stages)) {
+            __m128 active = bloop_filter_active(t, n);
+            s1_next = bloop_filter_select(active, s1_next, s1);
+            s2_next = bloop_filter_select(active, s2_next, s2);
+        }
+        s1 = s1_next;
+        s2 = s2_next;
+        if (t >= stages - 1) {
+            _mm_storeu_ps(last, y);
+            out[t - stages + 1] = last[stages - 1];
+        }
+    }
+    _mm_storeu_ps(data->s1, s1);
+    _mm_storeu_ps(data->s2, s2);
+#else
+    for (int s = 0; s < stages; s++) {
+        const float *x = s == 0 ? in : out;
+        for (int t = 0; t < n; t++) {
+            float y = b0[t] * x[t] + data->s1[s];
+            data->s1[s] = (b1[t] * x[t] + data->s2[s]) - a1[t] * y;
+            data->s2[s] = b2[t] * x[t] - a2[t] * y;
+            out[t] = y;
+        }
+    }
+#endif
+}
+
+void bloop_biquad_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_biquad_data *data = (bloop_biquad_data *) value;
+    float rows[BLOOP_BIQUAD_ROWS][BLOOP_FILTER_ROW];
+    bloop_filter_pad(rows, BLOOP_BIQUAD_ROWS, n);
+    bloop_biquad_coefficients(data->mode, inputs[BLOOP_FILTER_CUTOFF], inputs[BLOOP_FILTER_RESONANCE], rows, n);
+    bloop_biquad_run(data, rows, inputs[BLOOP_FILTER_INPUT], out, n);
+}
+
+void bloop_biquad_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_biquad_data *data = (bloop_biquad_data *) value;
+    float rows[BLOOP_BIQUAD_ROWS][BLOOP_FILTER_ROW];
+    bloop_filter_pad(rows, BLOOP_BIQUAD_ROWS, n);
+    bloop_biquad_coefficients(data->mode, inputs[BLOOP_FILTER_CUTOFF], inputs[BLOOP_FILTER_RESONANCE], rows, 1);
+    bloop_filter_fill(rows, BLOOP_BIQUAD_ROWS, n);
+    bloop_biquad_run(data, rows, inputs[BLOOP_FILTER_INPUT], out, n);
+}
+
+float bloop_biquad_(bloop_generator *g, void *value, bloop_tick tick) {
+    float input = bloop_run_input(g, BLOOP_FILTER_INPUT, tick);
+    float cutoff = bloop_run_input(g, BLOOP_FILTER_CUTOFF, tick);
+    float resonance = bloop_run_input(g, BLOOP_FILTER_RESONANCE, tick);
+    float *inputs[] = { &input, &cutoff, &resonance };
+    float out;
+    bloop_biquad_block_(g, value, inputs, &out, 1, tick);
+    return out;
+}
+
+
+
+// g = tan(pi * cutoff / SAMPLE_RATE) and k = 1 / resonance give
+// a1 = 1 / (1 + g * (g + k)), a2 = g * a1 and a3 = g * a2. The output is
+// m0 * input + m1 * band + m2 * low; the bandpass is scaled by k to peak at
+// 0 dB like the biquad.
+static void bloop_svf_coefficients(enum bloop_filter_mode mode, const float *cutoff, const float *resonance, bloop_filter_rows rows, int n) {
+    float sn[BLOOP_MAX_BLOCK];
+    float cs[BLOOP_MAX_BLOCK];
+    float *a1 = bloop_filter_row(rows, 0);
+    float *a2 = bloop_filter_row(rows, 1);
+    float *a3 = bloop_filter_row(rows, 2);
+    float *m0 = bloop_filter_row(rows, 3);
+    float *m1 = bloop_filter_row(rows, 4);
+    float *m2 = bloop_filter_row(rows, 5);
+    bloop_filter_angles(cutoff, BLOOP_TWO_PI / (2.0f * SAMPLE_RATE), sn, cs, n);
+    // m1 holds k until the mode is applied; separate loops for every mode,
+    // so they vectorize.
+    for (int i = 0; i < n; i++) {
+        float g = sn[i] / cs[i];
+        float q = resonance[i] > BLOOP_FILTER_MIN_RESONANCE ? resonance[i] : BLOOP_FILTER_MIN_RESONANCE;
+        m1[i] = 1.0f / q;
+        a1[i] = 1.0f / (1.0f + g * (g + m1[i]));
+        a2[i] = g * a1[i];
+        a3[i] = g * a2[i];
+    }
+    float input = mode == BLOOP_HIGHPASS || mode == BLOOP_NOTCH ? 1.0f : 0.0f;
+    float band = mode == BLOOP_LOWPASS ? 0.0f : (mode == BLOOP_BANDPASS ? 1.0f : -1.0f);
+    float low = mode == BLOOP_LOWPASS ? 1.0f : (mode == BLOOP_HIGHPASS ? -1.0f : 0.0f);
+    for (int i = 0; i < n; i++) {
+        m0[i] = input;
+        m1[i] = band * m1[i];
+        m2[i] = low;
+    }
+}
+
+static void bloop_svf_run(bloop_svf_data *data, bloop_filter_rows rows, const float *in, float *out, int n) {
+    const float *a1 = bloop_filter_row(rows, 0);
+    const float *a2 = bloop_filter_row(rows, 1);
+    const float *a3 = bloop_filter_row(rows, 2);
+    const float *m0 = bloop_filter_row(rows, 3);
+    const float *m1 = bloop_filter_row(rows, 4);
+    const float *m2 = bloop_filter_row(rows, 5);
+    int stages = data->stages;
+#if defined(__SSE2__)
+    __m128 ic1 = _mm_loadu_ps(data->ic1);
+    __m128 ic2 = _mm_loadu_ps(data->ic2);
+    __m128 y = _mm_setzero_ps();
+    __m128 used = bloop_filter_used(stages);
+    const __m128 two = _mm_set1_ps(2.0f);
+    float last[4];
+    for (int t = 0; t < n + stages - 1; t++) {
+        __m128 x = bloop_filter_shift(y, t < n ? in[t] : 0.0f);
+        __m128 c2 = bloop_filter_lanes(a2, t, used);
+        __m128 v3 = _mm_sub_ps(x, ic2);
+        __m128 v1 = _mm_add_ps(_mm_mul_ps(bloop_filter_lanes(a1, t, used), ic1), _mm_mul_ps(c2, v3));
+        __m128 v2 = _mm_add_ps(_mm_add_ps(ic2, _mm_mul_ps(c2, ic1)), _mm_mul_ps(bloop_filter_lanes(a3, t, used), v3));
+        y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(bloop_filter_lanes(m0, t, used), x), _mm_mul_ps(bloop_filter_lanes(m1, t, used), v1)), _mm_mul_ps(bloop_filter_lanes(m2, t, used), v2));
+        __m128 ic1_next = _mm_sub_ps(_mm_mul_ps(two, v1), ic1);
+        __m128 ic2_next = _mm_sub_ps(_mm_mul_ps(two, v2), ic2);
+        if (bloop_filter_edge(t, n, stages)) {
+            __m128 active = bloop_filter_active(t, n);
+            ic1_next = bloop_filter_select(active, ic1_next, ic1);
+            ic2_next = bloop_filter_select(active, ic2_next, ic2);
+        }
+        ic1 = ic1_next;
+        ic2 = ic2_next;
+        if (t >= stages - 1) {
+            _mm_storeu_ps(last, y);
+            out[t - stages + 1] = last[stages - 1];
+        }
+    }
+    _mm_storeu_ps(data->ic1, ic1);
+    _mm_storeu_ps(data->ic2, ic2);
+#else
+    for (int s = 0; s < stages; s++) {
+        const float *x = s == 0 ? in : out;
+        for (int t = 0; t < n; t++) {
+            float v3 = x[t] - data->ic2[s];
+            float v1 = a1[t] * data->ic1[s] + a2[t] * v3;
+            float v2 = data->ic2[s] + a2[t] * data->ic1[s] + a3[t] * v3;
+            float y = m0[t] * x[t] + m1[t] * v1 + m2[t] * v2;
+            data->ic1[s] = 2.0f * v1 - data->ic1[s];
+            data->ic2[s] = 2.0f * v2 - data->ic2[s];
+            out[t] = y;
+        }
+    }
+#endif
+}
+
+void bloop_svf_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_svf_data *data = (bloop_svf_data *) value;
+    float rows[BLOOP_SVF_ROWS][BLOOP_FILTER_ROW];
+    bloop_filter_pad(rows, BLOOP_SVF_ROWS, n);
+    bloop_svf_coefficients(data->mode, inputs[BLOOP_FILTER_CUTOFF], inputs[BLOOP_FILTER_RESONANCE], rows, n);
+    bloop_svf_run(data, rows, inputs[BLOOP_FILTER_INPUT], out, n);
+}
+
+void bloop_svf_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_svf_data *data = (bloop_svf_data *) value;
+    float rows[BLOOP_SVF_ROWS][BLOOP_FILTER_ROW];
+    bloop_filter_pad(rows, BLOOP_SVF_ROWS, n);
+    bloop_svf_coefficients(data->mode, inputs[BLOOP_FILTER_CUTOFF], inputs[BLOOP_FILTER_RESONANCE], rows, 1);
+    bloop_filter_fill(rows, BLOOP_SVF_ROWS, n);
+    bloop_svf_run(data, rows, inputs[BLOOP_FILTER_INPUT], out, n);
+}
+
+float bloop_svf_(bloop_generator *g, void *value, bloop_tick tick) {
+    float input = bloop_run_input(g, BLOOP_FILTER_INPUT, tick);
+    float cutoff = bloop_run_input(g, BLOOP_FILTER_CUTOFF, tick);
+    float resonance = bloop_run_input(g, BLOOP_FILTER_RESONANCE, tick);
+    float *inputs[] = { &input, &cutoff, &resonance };
+    float out;
+    bloop_svf_block_(g, value, inputs, &out, 1, tick);
+    return out;
+}
+
+
+
+static int bloop_filter_stages(int stages) {
+    return stages < 1 ? 1 : (stages > BLOOP_FILTER_MAX_STAGES ? BLOOP_FILTER_MAX_STAGES : stages);
+}
+
+static void bloop_filter_set_inputs(bloop_generator *g, bloop_generator *input, bloop_generator *cutoff, bloop_generator *resonance) {
+    bloop_set_input_count(g, 3);
+    bloop_set_generator_input(BLOOP_FILTER_INPUT, g, input, "input");
+    bloop_set_generator_input(BLOOP_FILTER_CUTOFF, g, cutoff, "cutoff");
+    bloop_set_generator_input(BLOOP_FILTER_RESONANCE, g, resonance, "resonance");
+}
+
+bloop_generator *bloop_biquad(bloop_generator *input, bloop_generator *cutoff, bloop_generator *resonance, enum bloop_filter_mode mode, int stages) {
+    bloop_biquad_data *v = bloop_calloc(1, sizeof(*v));
+    v->mode = mode;
+    v->stages = bloop_filter_stages(stages);
+    bloop_generator *g = bloop_new_generator(bloop_biquad_, BLOOP_BIQUAD, "BIQUAD", v);
+    g->block_fn = bloop_biquad_block_;
+    bloop_filter_set_inputs(g, input, cutoff, resonance);
+    return g;
+}
+
+bloop_generator *bloop_svf(bloop_generator *input, bloop_generator *cutoff, bloop_generator *resonance, enum bloop_filter_mode mode, int stages) {
+    bloop_svf_data *v = bloop_calloc(1, sizeof(*v));
+    v->mode = mode;
+    v->stages = bloop_filter_stages(stages);
+    bloop_generator *g = bloop_new_generator(bloop_svf_, BLOOP_SVF, "SVF", v);
+    g->block_fn = bloop_svf_block_;
+    bloop_filter_set_inputs(g, input, cutoff, resonance);
+    return g;
+}
+
+void bloop_filter_clear(bloop_generator *g) {
+    if (g->type == BLOOP_BIQUAD) {
+        bloop_biquad_data *data = (bloop_biquad_data *) g->userData;
+        memset(data->s1, 0, sizeof(data->s1));
+        memset(data->s2, 0, sizeof(data->s2));
+    } else {
+        bloop_svf_data *data = (bloop_svf_data *) g->userData;
+        memset(data->ic1, 0, sizeof(data->ic1));
+        memset(data->ic2, 0, sizeof(data->ic2));
+    }
+}
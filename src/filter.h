@@ -0,0 +1,73 @@
+#ifndef BLOOP_FILTER_H
+#define BLOOP_FILTER_H
+
+#include "bloop.h"
+
+/*
+ * Resonant filters: an RBJ biquad and a trapezoidal state variable filter,
+ * each with a lowpass, highpass, bandpass and notch mode, e.g.
+ *
+ *     bloop_generator *g = bloop_svf(osc, bloop_interpolation(6000, 300, 12000), C(4.0), BLOOP_LOWPASS, 2);
+ *
+ * The cutoff (in Hz) and the resonance (the Q, 0.707 for a flat response)
+ * are inputs like any other, so they can change every sample. The state
+ * variable filter stays well behaved when the cutoff moves fast; the biquad
+ * is the cheaper of the two when it doesn't.
+ *
+ * A filter has 1 to BLOOP_FILTER_MAX_STAGES identical stages in series, each
+ * adding 12 dB per octave to the slope.
+ *
+ * The recurrence of a filter can't be vectorized over time, so the block
+ * functions vectorize everything else: the coefficients of a whole block are
+ * computed at once (the sines with bloop_fast_sin_block), and the stages run
+ * in the lanes of a vector, lane k filtering sample t - k with stage k while
+ * lane 0 takes sample t. A block of n samples takes n + stages - 1 steps.
+ * With constant cutoff and resonance the coefficients are computed once per
+ * block.
+ */
+
+#define BLOOP_FILTER_INPUT 0
+#define BLOOP_FILTER_CUTOFF 1
+#define BLOOP_FILTER_RESONANCE 2
+
+#define BLOOP_FILTER_MAX_STAGES 4
+#define BLOOP_FILTER_MIN_RESONANCE 0.1f
+
+enum bloop_filter_mode {
+    BLOOP_LOWPASS,
+    BLOOP_HIGHPASS,
+    BLOOP_BANDPASS,
+    BLOOP_NOTCH,
+};
+
+// Transposed direct form II.
+typedef struct bloop_biquad_data {
+    enum bloop_filter_mode mode;
+    int stages;
+    float s1[BLOOP_FILTER_MAX_STAGES];
+    float s2[BLOOP_FILTER_MAX_STAGES];
+} bloop_biquad_data;
+
+// The integrator states of Andrew Simper's trapezoidal SVF.
+typedef struct bloop_svf_data {
+    enum bloop_filter_mode mode;
+    int stages;
+    float ic1[BLOOP_FILTER_MAX_STAGES];
+    float ic2[BLOOP_FILTER_MAX_STAGES];
+} bloop_svf_data;
+
+float bloop_biquad_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_svf_(bloop_generator *g, void *value, bloop_tick tick);
+
+void bloop_biquad_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_biquad_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_svf_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_svf_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+
+bloop_generator *bloop_biquad(bloop_generator *input, bloop_generator *cutoff, bloop_generator *resonance, enum bloop_filter_mode mode, int stages);
+bloop_generator *bloop_svf(bloop_generator *input, bloop_generator *cutoff, bloop_generator *resonance, enum bloop_filter_mode mode, int stages);
+
+// Puts the filter back at rest; see bloop_reset.
+void bloop_filter_clear(bloop_generator *g);
+
+#endif
@@ -1,5 +1,7 @@
 #include "kicks.h"
 
+extern int SAMPLE_RATE;
+
 bloop_generator *bloop_sine_kick_drum() {
     return bloop_interpolated_sine_wave(90, 16, 8000, 
         bloop_adsr(1.0, 0.2, 500, 500, 4000, 2000)
@@ -30,5 +32,28 @@ bloop_generator *bloop_kick_drum_hit() {
 }
 
 bloop_generator *bloop_kick_drum_rumble(bloop_generator *kick_drum) {
-    return bloop_delay(kick_drum, LFO(1.0, 22050, 11025), C(0.8), C(0.1));
+    return bloop_delay(kick_drum, LFO(1.0, 22050, 11025), C(0.8), C(0.1), SAMPLE_RATE);
+}
+
+bloop_generator *bloop_kick_rumble_wobble() {
+    bloop_generator *kick_drum_hit = bloop_white_noise(bloop_adsr(0.3, 0.0, 150, 150, 0, 0));
+    bloop_generator *kick_drum = bloop_distortion(bloop_sine_wave(bloop_interpolation(90, 36, 4000), bloop_adsr(1.0, 0.2, 500, 500, 4000, 2000)), bloop_interpolation(0.9, 0.2, 100), C(1.0));
+    bloop_generator *kick_drum1 = bloop_average(2, kick_drum, kick_drum_hit);
+    bloop_generator *kick_drum_rumble1 = bloop_delay(kick_drum1, LFO(1.0, 22050, 11025), C(0.8), C(0.1), SAMPLE_RATE);
+    bloop_generator *kick_drum_rumble2 = bloop_repeat(bloop_distortion(bloop_delay(bloop_average(2, kick_drum, kick_drum_rumble1), LFO(1.0, 11025, 5000), LFO(32.0, 0.7, 0.2), LFO(32.0, 0.5, 0.4), SAMPLE_RATE / 2), C(0.8), C(4.5)), 88200);
+    bloop_generator *wobble2 = bloop_sine_wave(bloop_lfo(LFO(8.0, 24, 24), C(880), C(440.0)), bloop_lfo(C(128.0), C(0.2), LFO(2, 0.1, 0.05)));
+    return bloop_average(2, kick_drum_rumble2, wobble2);
+}
+
+bloop_generator *bloop_velocity_kick_sequence() {
+    return bloop_repeat(
+            bloop_sequence(
+                6,
+                bloop_velocity_adjusted_sine_kick_drum(0.1), 22050,
+                bloop_velocity_adjusted_sine_kick_drum(0.3), 22050,
+                bloop_velocity_adjusted_sine_kick_drum(0.5), 22050,
+                bloop_velocity_adjusted_sine_kick_drum(0.7), 22050,
+                bloop_velocity_adjusted_sine_kick_drum(0.9), 22050,
+                bloop_velocity_adjusted_sine_kick_drum(1.0), 22050
+                ), 6 * 22050);
 }
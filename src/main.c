@@ -1,5 +1,12 @@
 #include "bloop.h"
 #include "kicks.h"
+#include "plan.h"
+#include "arena.h"
+#include "pool.h"
+#include "profile.h"
+#include "patchfile.h"
+#include "convolution.h"
+#include "sample.h"
 #include "ui.h"
 #define SOKOL_IMPL
 #include <sokol_audio.h>
@@ -19,41 +26,57 @@
 sg_pass_action pass_action;
 
 
-int tick = 0;
+bloop_tick tick = 0;
 bloop_generator *generator;
+bloop_plan *plan;
+bloop_arena *arena;
+bloop_callback_stats stats;
+// The patch file given on the command line, if any; Ctrl+S saves to it.
+const char *patch_path = "bloop.patch";
+int load_patch = 0;
 
 // the sample callback, running in audio thread
 static void stream_cb(float* buffer, int num_frames, int num_channels) {
-    static uint32_t count = 0;
-    for (int i = 0; i < num_frames; i++) {
-        buffer[i] = bloop_run(generator, tick);
-        tick += 1;
-    }
+    uint64_t start = stm_now();
+    bloop_plan_run_interleaved(plan, buffer, num_frames, num_channels, tick);
+    tick += num_frames;
+    bloop_stats_record(&stats, stm_since(start), num_frames);
 }
 
 void init(void) {
+    arena = bloop_arena_new(BLOOP_ARENA_CHUNK_SIZE);
+    bloop_arena_use(arena);
     generator = bloop_sine_wave(LFO(1.0, 440.0, 110.0), C(1.0)); 
-    bloop_generator *kick_drum_hit = bloop_white_noise(bloop_adsr(0.3, 0.0, 150, 150, 0, 0));
-    bloop_generator *kick_drum = bloop_distortion(bloop_sine_wave(bloop_interpolation(90, 36, 4000), bloop_adsr(1.0, 0.2, 500, 500, 4000, 2000)), bloop_interpolation(0.9, 0.2, 100), C(1.0));
-    bloop_generator *kick_drum1 = bloop_average(2, kick_drum, kick_drum_hit);
-    bloop_generator *kick_drum_rumble1 = bloop_delay(kick_drum1, LFO(1.0, 22050, 11025), C(0.8), C(0.1));
-    bloop_generator *kick_drum_rumble2 = bloop_repeat(bloop_distortion(bloop_delay(bloop_average(2, kick_drum, kick_drum_rumble1), LFO(1.0, 11025, 5000), LFO(32.0, 0.7, 0.2), LFO(32.0, 0.5, 0.4)), C(0.8), C(4.5)), 88200);
-    bloop_generator *wobble2 = bloop_sine_wave(bloop_lfo(LFO(8.0, 24, 24), C(880), C(440.0)), bloop_lfo(C(128.0), C(0.2), LFO(2, 0.1, 0.05)));
-    generator = bloop_average(2, kick_drum_rumble2, wobble2);
-    generator = bloop_repeat(
-            bloop_sequence(
-                6,
-                bloop_velocity_adjusted_sine_kick_drum(0.1), 22050,
-                bloop_velocity_adjusted_sine_kick_drum(0.3), 22050,
-                bloop_velocity_adjusted_sine_kick_drum(0.5), 22050,
-                bloop_velocity_adjusted_sine_kick_drum(0.7), 22050,
-                bloop_velocity_adjusted_sine_kick_drum(0.9), 22050,
-                bloop_velocity_adjusted_sine_kick_drum(1.0), 22050
-                ), 6 * 22050);
-
+    generator = bloop_kick_rumble_wobble();
+    generator = bloop_velocity_kick_sequence();
+    if (load_patch) {
+        bloop_patch_file *f = bloop_patch_file_open(patch_path);
+        bloop_generator *g = f == NULL ? NULL : bloop_patch_file_instantiate(f);
+        if (g != NULL) {
+            generator = g;
+        } else {
+            fprintf(stderr, "could not load %s\n", patch_path);
+        }
+        if (f != NULL) {
+            bloop_patch_file_close(f);
+        }
+    }
+    bloop_optimize(generator);
+    bloop_arena_use(NULL);
+    // The patch is mono; bloop_plan_run_interleaved plays it on both
+    // channels.
+    plan = bloop_plan_compile(generator);
+    // Three workers next to the audio thread.
+    bloop_pool_start(3);
+    bloop_convolution_start();
+    bloop_sample_prefetch_start();
+    stm_setup();
+    bloop_profile_enable(1);
+    bloop_stats_init(&stats);
 
     saudio_setup(&(saudio_desc){
-        .stream_cb = stream_cb
+        .stream_cb = stream_cb,
+        .num_channels = 2
     });
     sg_setup(&(sg_desc){
         .context = sapp_sgcontext()
@@ -71,6 +94,7 @@ void frame(void) {
     //pass_action.colors[0].value.g = (g > 1.0f) ? 0.0f : g;
     struct nk_context *ctx = snk_new_frame();
     node_editor(ctx);
+    audio_stats(ctx, &stats);
     sg_begin_default_pass(&pass_action, sapp_width(), sapp_height());
     snk_render(sapp_width(), sapp_height());
     sg_end_pass();
@@ -86,6 +110,13 @@ void event_handler(const struct sapp_event *event) {
             break;
         case SAPP_EVENTTYPE_MOUSE_MOVE: 
             break;
+        case SAPP_EVENTTYPE_KEY_DOWN:
+            if (event->key_code == SAPP_KEYCODE_S && (event->modifiers & SAPP_MODIFIER_CTRL)) {
+                if (bloop_patch_file_save(generator, patch_path) != 0) {
+                    fprintf(stderr, "could not save %s\n", patch_path);
+                }
+            }
+            break;
         default:
             break;
     }
@@ -96,9 +127,19 @@ void cleanup(void) {
     snk_shutdown();
     saudio_shutdown();
     sg_shutdown();
+    bloop_pool_stop();
+    bloop_convolution_stop();
+    bloop_sample_prefetch_stop();
+    bloop_stats_print(&stats, stderr);
+    bloop_plan_free(plan);
+    bloop_arena_free(arena);
 }
 
 sapp_desc sokol_main(int argc, char* argv[]) {
+    if (argc > 1) {
+        patch_path = argv[1];
+        load_patch = 1;
+    }
     return (sapp_desc){
         .init_cb = init,
         .frame_cb = frame,
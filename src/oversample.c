@@ -0,0 +1,274 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "oversample.h"
+#include "arena.h"
+#include "fastmath.h"
+
+// A Kaiser window with this beta keeps the stopband of the half-band filters
+// about 80 dB down.
+#define BLOOP_OVERSAMPLE_KAISER_BETA 8.0
+
+static double bloop_bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// The non-zero side taps of a windowed sinc half-band filter, scaled so they
+// add up to scale / 2 (the middle tap is 1/2).
+static float *bloop_halfband_design(int taps, double scale) {
+    float *coefficients = bloop_alloc(sizeof(float) * taps);
+    double sum = 0.0;
+    for (int i = 0; i < taps; i++) {
+        int k = 2 * i - (taps - 1);
+        double x = (double) k / taps;
+        double window = bloop_bessel_i0(BLOOP_OVERSAMPLE_KAISER_BETA * sqrt(1.0 - x * x)) / bloop_bessel_i0(BLOOP_OVERSAMPLE_KAISER_BETA);
+        double sinc = sin(M_PI * k / 2.0) / (M_PI * k);
+        coefficients[i] = (float)(sinc * window);
+        sum += coefficients[i];
+    }
+    for (int i = 0; i < taps; i++) {
+        coefficients[i] = (float)(coefficients[i] * 0.5 * scale / sum);
+    }
+    return coefficients;
+}
+
+static void bloop_halfband_init(bloop_halfband *h, int taps, double scale) {
+    h->taps = taps;
+    h->coefficients = bloop_halfband_design(taps, scale);
+    h->history = bloop_calloc(taps, sizeof(float));
+    h->odd = bloop_calloc(taps / 2, sizeof(float));
+}
+
+static void bloop_halfband_clear(bloop_halfband *h) {
+    memset(h->history, 0, sizeof(float) * h->taps);
+    memset(h->odd, 0, sizeof(float) * (h->taps / 2));
+}
+
+// Turns n (<= BLOOP_MAX_BLOCK / 2) samples into 2n. The even outputs are the
+// side taps, the odd ones the middle tap, which is a delayed input.
+static void bloop_halfband_up(bloop_halfband *h, const float *in, float *out, int n) {
+    float x[BLOOP_OVERSAMPLE_TAPS + BLOOP_MAX_BLOCK / 2];
+    float even[BLOOP_MAX_BLOCK / 2];
+    int taps = h->taps;
+    memcpy(x, h->history, sizeof(float) * taps);
+    memcpy(x + taps, in, sizeof(float) * n);
+    bloop_fir_block(h->coefficients, taps, x + taps, even, n);
+    const float *odd = x + taps - taps / 2 + 1;
+    for (int j = 0; j < n; j++) {
+        out[2 * j] = even[j];
+        out[2 * j + 1] = odd[j];
+    }
+    memcpy(h->history, x + n, sizeof(float) * taps);
+}
+
+// Turns 2n (<= BLOOP_MAX_BLOCK) samples into n. The even inputs go through
+// the side taps, the odd ones through the middle tap.
+static void bloop_halfband_down(bloop_halfband *h, const float *in, float *out, int n) {
+    float even[BLOOP_OVERSAMPLE_TAPS + BLOOP_MAX_BLOCK / 2];
+    float odd[BLOOP_OVERSAMPLE_TAPS / 2 + BLOOP_MAX_BLOCK / 2];
+    int taps = h->taps;
+    int half = taps / 2;
+    memcpy(even, h->history, sizeof(float) * taps);
+    memcpy(odd, h->odd, sizeof(float) * half);
+    for (int j = 0; j < n; j++) {
+        even[taps + j] = in[2 * j];
+        odd[half + j] = in[2 * j + 1];
+    }
+    bloop_fir_block(h->coefficients, taps, even + taps, out, n);
+    for (int j = 0; j < n; j++) {
+        out[j] += 0.5f * odd[j];
+    }
+    memcpy(h->history, even + n, sizeof(float) * taps);
+    memcpy(h->odd, odd + n, sizeof(float) * half);
+}
+
+#define bloop_oversample_taps(stage) ((stage) == 0 ? BLOOP_OVERSAMPLE_TAPS : BLOOP_OVERSAMPLE_INNER_TAPS)
+
+
+
+// Generators that can run at any rate: they keep no state and ignore the tick.
+static int bloop_oversample_is_pure(bloop_generator *g) {
+    switch (g->type) {
+        case BLOOP_DISTORTION:
+        case BLOOP_AVERAGE:
+        case BLOOP_PAN:
+        case BLOOP_CONSTANT:
+            return g->block_fn != NULL;
+        default:
+            return 0;
+    }
+}
+
+typedef struct bloop_oversample_region {
+    int leaf_count;
+    int leaf_capacity;
+    bloop_generator **leaves;
+    float **leaf_buffers;
+
+    int op_count;
+    int op_capacity;
+    bloop_oversample_op *ops;
+} bloop_oversample_region;
+
+// Returns the buffer g is rendered into, adding the operations for g and its
+// inputs (inputs first) or making g a leaf.
+static float *bloop_oversample_visit(bloop_oversample_region *r, bloop_generator *g) {
+    if (!bloop_oversample_is_pure(g)) {
+        for (int i = 0; i < r->leaf_count; i++) {
+            if (r->leaves[i] == g) {
+                return r->leaf_buffers[i];
+            }
+        }
+        if (r->leaf_count == r->leaf_capacity) {
+            r->leaf_capacity = r->leaf_capacity == 0 ? 4 : r->leaf_capacity * 2;
+            r->leaves = realloc(r->leaves, sizeof(bloop_generator *) * r->leaf_capacity);
+            r->leaf_buffers = realloc(r->leaf_buffers, sizeof(float *) * r->leaf_capacity);
+        }
+        r->leaves[r->leaf_count] = g;
+        r->leaf_buffers[r->leaf_count] = bloop_alloc(sizeof(float) * BLOOP_MAX_BLOCK);
+        return r->leaf_buffers[r->leaf_count++];
+    }
+
+    for (int i = 0; i < r->op_count; i++) {
+        if (r->ops[i].g == g) {
+            return r->ops[i].out;
+        }
+    }
+    float **inputs = bloop_calloc(g->input_count, sizeof(float *));
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] != NULL) {
+            inputs[i] = bloop_oversample_visit(r, g->inputs[i]);
+        }
+    }
+    if (r->op_count == r->op_capacity) {
+        r->op_capacity = r->op_capacity == 0 ? 4 : r->op_capacity * 2;
+        r->ops = realloc(r->ops, sizeof(bloop_oversample_op) * r->op_capacity);
+    }
+    bloop_oversample_op *op = &r->ops[r->op_count++];
+    op->g = g;
+    op->inputs = inputs;
+    op->out = bloop_alloc(sizeof(float) * BLOOP_MAX_BLOCK);
+    return op->out;
+}
+
+// Makes the leaves of the region the inputs of g.
+static void bloop_oversample_compile(bloop_generator *g) {
+    bloop_oversample_data *data = (bloop_oversample_data *) g->userData;
+    bloop_oversample_region r = { 0 };
+    data->out = bloop_oversample_visit(&r, data->region);
+
+    data->op_count = r.op_count;
+    data->ops = bloop_alloc(sizeof(bloop_oversample_op) * (r.op_count + 1));
+    for (int i = 0; i < r.op_count; i++) {
+        data->ops[i] = r.ops[i];
+    }
+
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] != NULL) {
+            g->inputs[i]->consumers--;
+        }
+    }
+    bloop_set_input_count(g, r.leaf_count);
+    data->leaves = bloop_alloc(sizeof(float *) * (r.leaf_count + 1));
+    data->up = bloop_alloc(sizeof(bloop_halfband) * (r.leaf_count * data->stages + 1));
+    data->values = bloop_calloc(r.leaf_count + 1, sizeof(float));
+    data->value_inputs = bloop_alloc(sizeof(float *) * (r.leaf_count + 1));
+    for (int i = 0; i < r.leaf_count; i++) {
+        bloop_set_generator_input(i, g, r.leaves[i], "input");
+        data->leaves[i] = r.leaf_buffers[i];
+        for (int s = 0; s < data->stages; s++) {
+            bloop_halfband_init(&data->up[i * data->stages + s], bloop_oversample_taps(s), 2.0);
+        }
+        data->value_inputs[i] = &data->values[i];
+    }
+
+    free(r.leaves);
+    free(r.leaf_buffers);
+    free(r.ops);
+}
+
+// Renders n samples from the input blocks at the normal rate. The region
+// renders BLOOP_MAX_BLOCK samples at a time at the higher rate.
+static void bloop_oversample_process(bloop_generator *g, bloop_oversample_data *data, float **inputs, float *out, int n, bloop_tick tick) {
+    float a[BLOOP_MAX_BLOCK];
+    float b[BLOOP_MAX_BLOCK];
+    int chunk = BLOOP_MAX_BLOCK / data->factor;
+    for (int done = 0; done < n; done += chunk) {
+        int m = n - done < chunk ? n - done : chunk;
+
+        for (int i = 0; i < g->input_count; i++) {
+            const float *in = inputs[i] + done;
+            int count = m;
+            for (int s = 0; s < data->stages; s++) {
+                float *to = s == data->stages - 1 ? data->leaves[i] : (s % 2 == 0 ? a : b);
+                bloop_halfband_up(&data->up[i * data->stages + s], in, to, count);
+                in = to;
+                count *= 2;
+            }
+        }
+
+        for (int i = 0; i < data->op_count; i++) {
+            bloop_oversample_op *op = &data->ops[i];
+            op->g->block_fn(op->g, op->g->userData, op->inputs, op->out, m * data->factor, (tick + done) * data->factor);
+        }
+
+        const float *in = data->out;
+        int count = m * data->factor;
+        for (int s = data->stages - 1; s >= 0; s--) {
+            float *to = s == 0 ? out + done : (s % 2 == 0 ? a : b);
+            bloop_halfband_down(&data->down[s], in, to, count / 2);
+            in = to;
+            count /= 2;
+        }
+    }
+}
+
+float bloop_oversample_(bloop_generator *g, void *value, bloop_tick tick) {
+    bloop_oversample_data *data = (bloop_oversample_data *) value;
+    for (int i = 0; i < g->input_count; i++) {
+        data->values[i] = bloop_run_input(g, i, tick);
+    }
+    float out;
+    bloop_oversample_process(g, data, data->value_inputs, &out, 1, tick);
+    return out;
+}
+
+void bloop_oversample_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_oversample_process(g, (bloop_oversample_data *) value, inputs, out, n, tick);
+}
+
+bloop_generator *bloop_oversample(bloop_generator *region, int factor) {
+    bloop_oversample_data *v = bloop_alloc(sizeof(*v));
+    v->stages = factor >= 8 ? 3 : (factor >= 4 ? 2 : 1);
+    v->factor = 1 << v->stages;
+    v->region = region;
+    for (int s = 0; s < v->stages; s++) {
+        bloop_halfband_init(&v->down[s], bloop_oversample_taps(s), 1.0);
+    }
+    bloop_generator *g = bloop_new_generator(bloop_oversample_, BLOOP_OVERSAMPLE, "OVERSAMPLE", v);
+    g->block_fn = bloop_oversample_block_;
+    bloop_oversample_compile(g);
+    return g;
+}
+
+void bloop_oversample_optimize(bloop_generator *g) {
+    bloop_oversample_data *data = (bloop_oversample_data *) g->userData;
+    bloop_optimize(data->region);
+    bloop_oversample_compile(g);
+}
+
+void bloop_oversample_clear(bloop_generator *g) {
+    bloop_oversample_data *data = (bloop_oversample_data *) g->userData;
+    for (int i = 0; i < g->input_count * data->stages; i++) {
+        bloop_halfband_clear(&data->up[i]);
+    }
+    for (int s = 0; s < data->stages; s++) {
+        bloop_halfband_clear(&data->down[s]);
+    }
+}
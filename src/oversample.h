@@ -0,0 +1,86 @@
+#ifndef BLOOP_OVERSAMPLE_H
+#define BLOOP_OVERSAMPLE_H
+
+#include "bloop.h"
+
+/*
+ * An oversampled region renders a nonlinear part of a patch (e.g. a hard
+ * clipping distortion) at 2, 4 or 8 times the sample rate, so the harmonics
+ * it adds above half the sample rate are filtered out instead of folding
+ * back down as aliasing:
+ *
+ *     bloop_generator *g = bloop_oversample(bloop_distortion(kick, C(0.3), C(2.0)), 4);
+ *
+ * Only the generators without state that don't depend on the tick
+ * (distortion, average, pan and constants) run at the higher rate. Every
+ * other generator below the region is a boundary of the region: it is an
+ * input of the oversample generator, rendered at the normal rate like any
+ * other input and upsampled on its way into the region. So in the example
+ * above the kick drum is rendered once per sample and only the clipping is
+ * rendered four times.
+ *
+ * Upsampling and downsampling go through a cascade of polyphase half-band
+ * filters, one stage per factor of 2. Half of the taps of a half-band filter
+ * are zero and the middle one is 1/2, so every stage costs a single FIR of
+ * the side taps at the lower rate, which computes 4 (SSE2) or 8 (AVX2)
+ * consecutive samples at a time. The stage next to the sample rate gets the
+ * longest filter, as it has the narrowest transition band.
+ *
+ * The filters are linear phase and delay the region by 31 samples at 2x,
+ * 38.5 at 4x and 42.25 at 8x.
+ */
+
+#define BLOOP_OVERSAMPLE_MAX_STAGES 3
+// Non-zero taps on the sides of the half-band filters, an even number.
+#define BLOOP_OVERSAMPLE_TAPS 32
+#define BLOOP_OVERSAMPLE_INNER_TAPS 16
+
+// One stage of a cascade. The histories hold the last samples of the
+// previous block, oldest first.
+typedef struct bloop_halfband {
+    int taps;
+    const float *coefficients;
+    float *history;
+    // Decimators only: the last taps / 2 odd samples, for the middle tap.
+    float *odd;
+} bloop_halfband;
+
+// A generator of the region, rendered from the buffers of its inputs.
+typedef struct bloop_oversample_op {
+    bloop_generator *g;
+    float **inputs;
+    float *out;
+} bloop_oversample_op;
+
+// Input i of the oversample generator is upsampled into leaves[i] through
+// up[i * stages] up to up[i * stages + stages - 1].
+typedef struct bloop_oversample_data {
+    int factor;
+    int stages;
+    bloop_generator *region;
+
+    int op_count;
+    bloop_oversample_op *ops;
+    float **leaves;
+    float *out;
+
+    bloop_halfband *up;
+    bloop_halfband down[BLOOP_OVERSAMPLE_MAX_STAGES];
+
+    // Inputs for the per-sample function.
+    float *values;
+    float **value_inputs;
+} bloop_oversample_data;
+
+float bloop_oversample_(bloop_generator *g, void *value, bloop_tick tick);
+void bloop_oversample_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+
+// factor is 2, 4 or 8.
+bloop_generator *bloop_oversample(bloop_generator *region, int factor);
+
+// Optimizes the region and compiles it again; see bloop_optimize.
+void bloop_oversample_optimize(bloop_generator *g);
+// Clears the filters; see bloop_reset.
+void bloop_oversample_clear(bloop_generator *g);
+
+#endif
@@ -0,0 +1,118 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "patches.h"
+#include "kicks.h"
+#include "voices.h"
+#include "oversample.h"
+#include "filter.h"
+#include "convolution.h"
+#include "fdn.h"
+#include "random.h"
+
+extern int SAMPLE_RATE;
+
+static bloop_generator *bloop_sine_kick_drum_rumble() {
+    return bloop_kick_drum_rumble(bloop_sine_kick_drum());
+}
+
+// A wobble whose speed and volume can be changed from the node editor.
+static bloop_generator *bloop_param_wobble() {
+    return bloop_sine_wave(
+            bloop_lfo(bloop_param(8.0, 0.0, 32.0, 441), C(440.0), C(220.0)),
+            bloop_param(0.5, 0.0, 1.0, 441));
+}
+
+// A hard clipped sweep; without oversampling, the harmonics above half the
+// sample rate fold back down as tones sweeping the other way.
+static bloop_generator *bloop_oversampled_fuzz() {
+    return bloop_oversample(
+            bloop_distortion(
+                bloop_sine_wave(bloop_lfo(C(0.25), C(1320.0), C(880.0)), C(1.0)),
+                C(0.2), C(4.0)),
+            4);
+}
+
+// Noise through a resonant lowpass that sweeps up and down.
+static bloop_generator *bloop_filter_sweep() {
+    return bloop_svf(bloop_white_noise(C(0.5)), LFO(0.5, 1200.0, 1000.0), C(6.0), BLOOP_LOWPASS, 2);
+}
+
+// A clipped sine with a filter envelope, the voice of the subtractive pad.
+static bloop_generator *bloop_subtractive_voice(bloop_generator *pitch) {
+    bloop_generator *osc = bloop_distortion(bloop_sine_wave(pitch, bloop_adsr(1.0, 0.6, 400, 4000, 20000, 8000)), C(0.3), C(3.0));
+    return bloop_biquad(osc, bloop_interpolation(6000.0, 400.0, 16000), C(2.0), BLOOP_LOWPASS, 2);
+}
+
+// Chords of long notes on 64 voices, so most of the voices are playing.
+static bloop_generator *bloop_subtractive_pad() {
+    float pitches[] = { 110.0, 130.81, 164.81, 196.0, 220.0, 261.63, 329.63, 392.0 };
+    bloop_generator *g = bloop_voices(64, 0, bloop_subtractive_voice);
+    for (int i = 0; i < 240; i++) {
+        bloop_voices_note_on(g, i * 441, pitches[i % 8] * (i % 64 < 32 ? 1.0 : 1.5), 0.05);
+    }
+    return g;
+}
+
+static bloop_generator *bloop_pluck_voice(bloop_generator *pitch) {
+    return bloop_sine_wave(pitch, bloop_adsr(1.0, 0.3, 200, 2000, 6000, 8000));
+}
+
+// Overlapping notes that need more voices than there are, so voices get
+// stolen.
+static bloop_generator *bloop_voice_arpeggio() {
+    float pitches[] = { 220.0, 261.63, 329.63, 392.0, 440.0, 392.0, 329.63, 261.63 };
+    bloop_generator *g = bloop_voices(8, 0, bloop_pluck_voice);
+    for (int i = 0; i < 128; i++) {
+        bloop_voices_note_on(g, i * 2205, pitches[i % 8] * (i % 32 < 16 ? 1.0 : 0.5), 0.2 + 0.05 * (i % 4));
+    }
+    return g;
+}
+
+// The arpeggio in a synthetic room: an impulse response of noise that dies
+// away by 60 dB over 1.5 seconds.
+static bloop_generator *bloop_room_reverb() {
+    int length = 3 * SAMPLE_RATE / 2;
+    float *ir = malloc(sizeof(float) * length);
+    bloop_random r;
+    bloop_random_init(&r);
+    bloop_random_fill(&r, ir, length);
+    for (int i = 0; i < length; i++) {
+        ir[i] *= 0.025f * expf(-6.9f * i / length);
+    }
+    bloop_generator *g = bloop_convolution(bloop_voice_arpeggio(), ir, length, C(0.3));
+    free(ir);
+    return g;
+}
+
+// The arpeggio in a hall, from the feedback delay network.
+static bloop_generator *bloop_hall_reverb() {
+    return bloop_fdn(bloop_voice_arpeggio(), C(2.5), C(6000.0), C(0.3), 8, 1.5f);
+}
+
+bloop_patch bloop_patches[] = {
+    { "sine_kick_drum", bloop_sine_kick_drum },
+    { "distorted_sine_kick_drum", bloop_distorted_sine_kick_drum },
+    { "kick_drum_hit", bloop_kick_drum_hit },
+    { "kick_drum_rumble", bloop_sine_kick_drum_rumble },
+    { "kick_rumble_wobble", bloop_kick_rumble_wobble },
+    { "velocity_kick_sequence", bloop_velocity_kick_sequence },
+    { "param_wobble", bloop_param_wobble },
+    { "voice_arpeggio", bloop_voice_arpeggio },
+    { "oversampled_fuzz", bloop_oversampled_fuzz },
+    { "filter_sweep", bloop_filter_sweep },
+    { "subtractive_pad", bloop_subtractive_pad },
+    { "room_reverb", bloop_room_reverb },
+    { "hall_reverb", bloop_hall_reverb },
+};
+
+int bloop_patch_count = sizeof(bloop_patches) / sizeof(bloop_patches[0]);
+
+bloop_patch *bloop_find_patch(const char *name) {
+    for (int i = 0; i < bloop_patch_count; i++) {
+        if (strcmp(bloop_patches[i].name, name) == 0) {
+            return &bloop_patches[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,18 @@
+#ifndef BLOOP_PATCHES
+#define BLOOP_PATCHES
+
+#include "bloop.h"
+
+// A named patch that the tools can build by name.
+typedef struct bloop_patch {
+    char *name;
+    bloop_generator *(*build)();
+} bloop_patch;
+
+extern bloop_patch bloop_patches[];
+extern int bloop_patch_count;
+
+// Returns NULL if there is no patch with that name.
+bloop_patch *bloop_find_patch(const char *name);
+
+#endif
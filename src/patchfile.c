@@ -0,0 +1,474 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "patchfile.h"
+#include "stereo.h"
+#include "oversample.h"
+#include "filter.h"
+#include "fdn.h"
+
+// The number of inputs and parameters of every type; -1 when it depends on
+// the node. Voices can't be stored, as their voices are built by a function,
+// and neither can samples and convolutions, whose audio comes from files
+// outside the patch, or generators with more than one output, as a file has
+// a single root.
+// Oversampled regions are stored with their region as their only input.
+//
+// Bit i of optional is set when input i may be missing (-1, built as NULL).
+// Every generator reads all of its inputs, so no type has any so far.
+static const struct {
+    int inputs;
+    int values;
+    uint32_t optional;
+} bloop_patch_file_types[] = {
+    [BLOOP_SINE] = { 2, 0 },
+    [BLOOP_WHITE_NOISE] = { 1, 0 },
+    [BLOOP_INTERPOLATION] = { 0, 3 },
+    [BLOOP_CONSTANT] = { 0, 1 },
+    [BLOOP_ADSR] = { 0, 6 },
+    [BLOOP_LFO] = { 3, 0 },
+    [BLOOP_DISTORTION] = { 3, 0 },
+    [BLOOP_DELAY] = { 4, 1 },
+    [BLOOP_REPEAT] = { 1, 1 },
+    [BLOOP_OFFSET] = { 1, 1 },
+    [BLOOP_AVERAGE] = { -1, 0 },
+    [BLOOP_SEQUENCE] = { -1, -1 },
+    [BLOOP_PARAM] = { 0, 4 },
+    [BLOOP_PAN] = { 2, 2 },
+    [BLOOP_OVERSAMPLE] = { 1, 1 },
+    [BLOOP_BIQUAD] = { 3, 2 },
+    [BLOOP_SVF] = { 3, 2 },
+    [BLOOP_FDN] = { 4, 2 },
+};
+
+#define BLOOP_PATCH_FILE_TYPE_COUNT ((int)(sizeof(bloop_patch_file_types) / sizeof(bloop_patch_file_types[0])))
+
+// The longest repeat, sequence step, interpolation or envelope a file can
+// hold: an hour at 192 kHz.
+#define BLOOP_PATCH_FILE_MAX_TICKS (3600 * 192000)
+
+static int bloop_patch_file_optional(uint32_t type, uint32_t input) {
+    return input < 32 && (bloop_patch_file_types[type].optional >> input & 1);
+}
+
+// Types that are missing from the table have no inputs and no parameters.
+static int bloop_patch_file_storable(uint32_t type) {
+    return type < BLOOP_PATCH_FILE_TYPE_COUNT && (bloop_patch_file_types[type].inputs != 0 || bloop_patch_file_types[type].values != 0);
+}
+
+// Whether count elements of size bytes starting at offset fit in the file.
+static int bloop_patch_file_fits(bloop_patch_file *f, uint32_t offset, uint32_t count, size_t size) {
+    return offset % 4 == 0 && (uint64_t)offset + (uint64_t)count * size <= f->size;
+}
+
+bloop_patch_file *bloop_patch_file_open(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(bloop_patch_file_header)) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    bloop_patch_file *f = malloc(sizeof(*f));
+    f->data = data;
+    f->size = st.st_size;
+    f->header = (const bloop_patch_file_header *) data;
+    const bloop_patch_file_header *h = f->header;
+    if (memcmp(h->magic, BLOOP_PATCH_FILE_MAGIC, 4) != 0 ||
+            h->version != BLOOP_PATCH_FILE_VERSION ||
+            h->byte_order != BLOOP_PATCH_FILE_BYTE_ORDER ||
+            h->root >= h->node_count ||
+            !bloop_patch_file_fits(f, h->nodes, h->node_count, sizeof(bloop_patch_file_node)) ||
+            !bloop_patch_file_fits(f, h->inputs, h->input_count, sizeof(int32_t)) ||
+            !bloop_patch_file_fits(f, h->values, h->value_count, sizeof(bloop_patch_file_value))) {
+        bloop_patch_file_close(f);
+        return NULL;
+    }
+    f->nodes = (const bloop_patch_file_node *) ((const char *) data + h->nodes);
+    f->inputs = (const int32_t *) ((const char *) data + h->inputs);
+    f->values = (const bloop_patch_file_value *) ((const char *) data + h->values);
+    return f;
+}
+
+void bloop_patch_file_close(bloop_patch_file *f) {
+    munmap(f->data, f->size);
+    free(f);
+}
+
+// Checks node index against the header and the shape of its type, that its
+// inputs are earlier nodes (or missing, where the type allows it) and that
+// its parameters are in range, so a damaged file can't make a constructor
+// crash or allocate without bounds.
+static int bloop_patch_file_check(bloop_patch_file *f, uint32_t index) {
+    const bloop_patch_file_header *h = f->header;
+    const bloop_patch_file_node *node = &f->nodes[index];
+    if (!bloop_patch_file_storable(node->type) ||
+            (uint64_t)node->input_start + node->input_count > h->input_count ||
+            (uint64_t)node->value_start + node->value_count > h->value_count) {
+        return 0;
+    }
+    int inputs = bloop_patch_file_types[node->type].inputs;
+    int values = bloop_patch_file_types[node->type].values;
+    if ((inputs >= 0 && node->input_count != inputs) || (values >= 0 && node->value_count != values)) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < node->input_count; i++) {
+        int32_t input = f->inputs[node->input_start + i];
+        if (input < -1 || input >= (int64_t)index || (input == -1 && !bloop_patch_file_optional(node->type, i))) {
+            return 0;
+        }
+    }
+    const bloop_patch_file_value *v = f->values + node->value_start;
+    switch (node->type) {
+        case BLOOP_INTERPOLATION:
+            return v[2].i > 0 && v[2].i <= BLOOP_PATCH_FILE_MAX_TICKS;
+        case BLOOP_ADSR: {
+            // The attack divides by its length; the other stages can be
+            // skipped.
+            int64_t length = 0;
+            for (int i = 2; i < 6; i++) {
+                if (v[i].i < (i == 2 ? 1 : 0)) {
+                    return 0;
+                }
+                length += v[i].i;
+            }
+            return length <= BLOOP_PATCH_FILE_MAX_TICKS;
+        }
+        case BLOOP_AVERAGE:
+            return node->input_count > 0;
+        case BLOOP_SEQUENCE:
+            if (node->input_count == 0 || node->value_count != node->input_count) {
+                return 0;
+            }
+            for (uint32_t i = 0; i < node->value_count; i++) {
+                if (v[i].i < 0 || v[i].i > BLOOP_PATCH_FILE_MAX_TICKS) {
+                    return 0;
+                }
+            }
+            break;
+        case BLOOP_DELAY:
+            return v[0].i > 0 && v[0].i <= BLOOP_MAX_DELAY;
+        case BLOOP_REPEAT:
+            return v[0].i > 0 && v[0].i <= BLOOP_PATCH_FILE_MAX_TICKS;
+        case BLOOP_PAN:
+            return v[0].i >= 0 && v[0].i < v[1].i && v[1].i <= BLOOP_PAN_MAX_CHANNELS;
+        case BLOOP_BIQUAD:
+        case BLOOP_SVF:
+            return v[0].i >= BLOOP_LOWPASS && v[0].i <= BLOOP_NOTCH && v[1].i >= 1 && v[1].i <= BLOOP_FILTER_MAX_STAGES;
+        case BLOOP_OVERSAMPLE:
+            return v[0].i == 2 || v[0].i == 4 || v[0].i == 8;
+        case BLOOP_FDN:
+            return (v[0].i == 8 || v[0].i == 16) && v[1].f >= BLOOP_FDN_MIN_SIZE && v[1].f <= BLOOP_FDN_MAX_SIZE;
+        default:
+            break;
+    }
+    return 1;
+}
+
+static bloop_generator *bloop_patch_file_build(bloop_patch_file *f, uint32_t index, bloop_generator **built) {
+    const bloop_patch_file_node *node = &f->nodes[index];
+    const bloop_patch_file_value *v = f->values + node->value_start;
+    bloop_generator **in = malloc(sizeof(bloop_generator *) * (node->input_count + 1));
+    for (uint32_t i = 0; i < node->input_count; i++) {
+        int32_t input = f->inputs[node->input_start + i];
+        in[i] = input < 0 ? NULL : built[input];
+    }
+
+    bloop_generator *g = NULL;
+    switch (node->type) {
+        case BLOOP_SINE:
+            g = bloop_sine_wave(in[SINE_WAVE_PITCH], in[SINE_WAVE_GAIN]);
+            break;
+        case BLOOP_WHITE_NOISE:
+            g = bloop_white_noise(in[WHITE_NOISE_GAIN]);
+            break;
+        case BLOOP_INTERPOLATION:
+            g = bloop_interpolation(v[0].f, v[1].f, v[2].i);
+            break;
+        case BLOOP_CONSTANT:
+            g = bloop_constant(v[0].f);
+            break;
+        case BLOOP_ADSR:
+            g = bloop_adsr(v[0].f, v[1].f, v[2].i, v[3].i, v[4].i, v[5].i);
+            break;
+        case BLOOP_LFO:
+            g = bloop_lfo(in[BLOOP_LFO_SPEED], in[BLOOP_LFO_OFFSET], in[BLOOP_LFO_AMOUNT]);
+            break;
+        case BLOOP_DISTORTION:
+            g = bloop_distortion(in[BLOOP_DISTORTION_INPUT], in[BLOOP_DISTORTION_LEVEL], in[BLOOP_DISTORTION_GAIN]);
+            break;
+        case BLOOP_DELAY:
+            g = bloop_delay(in[BLOOP_DELAY_INPUT], in[BLOOP_DELAY_SAMPLES], in[BLOOP_DELAY_FACTOR], in[BLOOP_DELAY_FEEDBACK], v[0].i);
+            break;
+        case BLOOP_REPEAT:
+            g = bloop_repeat(in[BLOOP_REPEAT_INPUT], v[0].i);
+            break;
+        case BLOOP_OFFSET:
+            g = bloop_offset(in[BLOOP_OFFSET_INPUT], v[0].i);
+            break;
+        case BLOOP_AVERAGE:
+            g = bloop_average_array(node->input_count, in);
+            break;
+        case BLOOP_SEQUENCE: {
+            int *lengths = malloc(sizeof(int) * (node->value_count + 1));
+            for (uint32_t i = 0; i < node->value_count; i++) {
+                lengths[i] = v[i].i;
+            }
+            g = bloop_sequence_array(node->input_count, in, lengths);
+            free(lengths);
+            break;
+        }
+        case BLOOP_PAN:
+            g = bloop_pan_channel(in[BLOOP_PAN_INPUT], in[BLOOP_PAN_POSITION], v[0].i, v[1].i);
+            break;
+        case BLOOP_PARAM:
+            g = bloop_param(v[0].f, v[1].f, v[2].f, 0);
+            ((bloop_param_data *) g->userData)->smoothing = v[3].f;
+            break;
+        case BLOOP_OVERSAMPLE:
+            g = bloop_oversample(in[0], v[0].i);
+            break;
+        case BLOOP_BIQUAD:
+            g = bloop_biquad(in[BLOOP_FILTER_INPUT], in[BLOOP_FILTER_CUTOFF], in[BLOOP_FILTER_RESONANCE], v[0].i, v[1].i);
+            break;
+        case BLOOP_SVF:
+            g = bloop_svf(in[BLOOP_FILTER_INPUT], in[BLOOP_FILTER_CUTOFF], in[BLOOP_FILTER_RESONANCE], v[0].i, v[1].i);
+            break;
+        case BLOOP_FDN:
+            g = bloop_fdn(in[BLOOP_FDN_INPUT], in[BLOOP_FDN_DECAY], in[BLOOP_FDN_DAMPING], in[BLOOP_FDN_MIX], v[0].i, v[1].f);
+            break;
+    }
+    free(in);
+    return g;
+}
+
+bloop_generator *bloop_patch_file_instantiate(bloop_patch_file *f) {
+    const bloop_patch_file_header *h = f->header;
+    bloop_generator **built = malloc(sizeof(bloop_generator *) * h->node_count);
+    bloop_generator *root = NULL;
+    for (uint32_t i = 0; i < h->node_count; i++) {
+        if (!bloop_patch_file_check(f, i)) {
+            break;
+        }
+        built[i] = bloop_patch_file_build(f, i, built);
+        if (i == h->root) {
+            root = built[i];
+            break;
+        }
+    }
+    free(built);
+    return root;
+}
+
+
+
+// The file as it is being put together by bloop_patch_file_save.
+typedef struct bloop_patch_file_writer {
+    bloop_generator **generators;
+    bloop_patch_file_node *nodes;
+    int node_count;
+    int node_capacity;
+
+    int32_t *inputs;
+    int input_count;
+    int input_capacity;
+
+    bloop_patch_file_value *values;
+    int value_count;
+    int value_capacity;
+} bloop_patch_file_writer;
+
+static void *bloop_patch_file_grow(void *p, int *capacity, int needed, size_t size) {
+    if (needed <= *capacity) {
+        return p;
+    }
+    while (*capacity < needed) {
+        *capacity = *capacity == 0 ? 64 : *capacity * 2;
+    }
+    return realloc(p, size * *capacity);
+}
+
+static void bloop_patch_file_value_f(bloop_patch_file_writer *w, float f) {
+    w->values = bloop_patch_file_grow(w->values, &w->value_capacity, w->value_count + 1, sizeof(bloop_patch_file_value));
+    w->values[w->value_count++].f = f;
+}
+
+static void bloop_patch_file_value_i(bloop_patch_file_writer *w, int32_t i) {
+    w->values = bloop_patch_file_grow(w->values, &w->value_capacity, w->value_count + 1, sizeof(bloop_patch_file_value));
+    w->values[w->value_count++].i = i;
+}
+
+static void bloop_patch_file_add_values(bloop_patch_file_writer *w, bloop_generator *g) {
+    switch (g->type) {
+        case BLOOP_INTERPOLATION: {
+            bloop_interpolation_data *data = (bloop_interpolation_data *) g->userData;
+            bloop_patch_file_value_f(w, data->from);
+            bloop_patch_file_value_f(w, data->to);
+            bloop_patch_file_value_i(w, data->over);
+            break;
+        }
+        case BLOOP_CONSTANT:
+            bloop_patch_file_value_f(w, *(float *) g->userData);
+            break;
+        case BLOOP_ADSR: {
+            bloop_adsr_data *data = (bloop_adsr_data *) g->userData;
+            bloop_patch_file_value_f(w, data->max_gain);
+            bloop_patch_file_value_f(w, data->sustain);
+            bloop_patch_file_value_i(w, data->attack_samples);
+            bloop_patch_file_value_i(w, data->decay_samples);
+            bloop_patch_file_value_i(w, data->sustain_samples);
+            bloop_patch_file_value_i(w, data->release_samples);
+            break;
+        }
+        case BLOOP_DELAY:
+            bloop_patch_file_value_i(w, ((bloop_delay_data *) g->userData)->max_delay);
+            break;
+        case BLOOP_REPEAT:
+            bloop_patch_file_value_i(w, ((bloop_repeat_data *) g->userData)->every);
+            break;
+        case BLOOP_OFFSET:
+            bloop_patch_file_value_i(w, ((bloop_offset_data *) g->userData)->offset);
+            break;
+        case BLOOP_SEQUENCE: {
+            bloop_sequence_data *data = (bloop_sequence_data *) g->userData;
+            for (int i = 0; i < data->count; i++) {
+                bloop_patch_file_value_i(w, (int32_t)(data->ends[i] - (i == 0 ? 0 : data->ends[i - 1])));
+            }
+            break;
+        }
+        case BLOOP_PAN: {
+            bloop_pan_data *data = (bloop_pan_data *) g->userData;
+            bloop_patch_file_value_i(w, data->channel);
+            bloop_patch_file_value_i(w, data->channels);
+            break;
+        }
+        case BLOOP_PARAM: {
+            bloop_param_data *data = (bloop_param_data *) g->userData;
+            bloop_patch_file_value_f(w, bloop_param_get(g));
+            bloop_patch_file_value_f(w, data->min);
+            bloop_patch_file_value_f(w, data->max);
+            bloop_patch_file_value_f(w, data->smoothing);
+            break;
+        }
+        case BLOOP_OVERSAMPLE:
+            bloop_patch_file_value_i(w, ((bloop_oversample_data *) g->userData)->factor);
+            break;
+        case BLOOP_BIQUAD: {
+            bloop_biquad_data *data = (bloop_biquad_data *) g->userData;
+            bloop_patch_file_value_i(w, data->mode);
+            bloop_patch_file_value_i(w, data->stages);
+            break;
+        }
+        case BLOOP_SVF: {
+            bloop_svf_data *data = (bloop_svf_data *) g->userData;
+            bloop_patch_file_value_i(w, data->mode);
+            bloop_patch_file_value_i(w, data->stages);
+            break;
+        }
+        case BLOOP_FDN: {
+            bloop_fdn_data *data = (bloop_fdn_data *) g->userData;
+            bloop_patch_file_value_i(w, data->lines);
+            bloop_patch_file_value_f(w, data->size);
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Adds g after its inputs and returns its index, or -1 if it can't be stored.
+static int bloop_patch_file_add(bloop_patch_file_writer *w, bloop_generator *g) {
+    for (int i = 0; i < w->node_count; i++) {
+        if (w->generators[i] == g) {
+            return i;
+        }
+    }
+    if (!bloop_patch_file_storable(g->type)) {
+        return -1;
+    }
+    bloop_generator **g_inputs = g->inputs;
+    int input_count = g->input_count;
+    if (g->type == BLOOP_OVERSAMPLE) {
+        // The inputs are the leaves of the region, which are stored with it.
+        g_inputs = &((bloop_oversample_data *) g->userData)->region;
+        input_count = 1;
+    }
+    int32_t *inputs = malloc(sizeof(int32_t) * (input_count + 1));
+    for (int i = 0; i < input_count; i++) {
+        inputs[i] = -1;
+        if (g_inputs[i] != NULL) {
+            inputs[i] = bloop_patch_file_add(w, g_inputs[i]);
+        }
+        if (inputs[i] < 0 && (g_inputs[i] != NULL || !bloop_patch_file_optional(g->type, i))) {
+            free(inputs);
+            return -1;
+        }
+    }
+
+    int index = w->node_count++;
+    if (w->node_count > w->node_capacity) {
+        w->node_capacity = w->node_capacity == 0 ? 64 : w->node_capacity * 2;
+        w->generators = realloc(w->generators, sizeof(bloop_generator *) * w->node_capacity);
+        w->nodes = realloc(w->nodes, sizeof(bloop_patch_file_node) * w->node_capacity);
+    }
+    w->generators[index] = g;
+    bloop_patch_file_node *node = &w->nodes[index];
+    node->type = g->type;
+    node->input_start = w->input_count;
+    node->input_count = input_count;
+    w->inputs = bloop_patch_file_grow(w->inputs, &w->input_capacity, w->input_count + input_count, sizeof(int32_t));
+    for (int i = 0; i < input_count; i++) {
+        w->inputs[w->input_count++] = inputs[i];
+    }
+    free(inputs);
+    node->value_start = w->value_count;
+    bloop_patch_file_add_values(w, g);
+    node->value_count = w->value_count - node->value_start;
+    return index;
+}
+
+int bloop_patch_file_save(bloop_generator *g, const char *path) {
+    bloop_patch_file_writer w = { 0 };
+    int root = bloop_patch_file_add(&w, g);
+    int result = -1;
+    FILE *f = root < 0 ? NULL : fopen(path, "wb");
+    if (f != NULL) {
+        bloop_patch_file_header h = { 0 };
+        memcpy(h.magic, BLOOP_PATCH_FILE_MAGIC, 4);
+        h.version = BLOOP_PATCH_FILE_VERSION;
+        h.byte_order = BLOOP_PATCH_FILE_BYTE_ORDER;
+        h.root = root;
+        h.node_count = w.node_count;
+        h.input_count = w.input_count;
+        h.value_count = w.value_count;
+        h.nodes = sizeof(h);
+        h.inputs = h.nodes + sizeof(bloop_patch_file_node) * w.node_count;
+        h.values = h.inputs + sizeof(int32_t) * w.input_count;
+        if (fwrite(&h, sizeof(h), 1, f) == 1 &&
+                fwrite(w.nodes, sizeof(bloop_patch_file_node), w.node_count, f) == (size_t)w.node_count &&
+                fwrite(w.inputs, sizeof(int32_t), w.input_count, f) == (size_t)w.input_count &&
+                fwrite(w.values, sizeof(bloop_patch_file_value), w.value_count, f) == (size_t)w.value_count) {
+            result = 0;
+        }
+        if (fclose(f) != 0) {
+            result = -1;
+        }
+    }
+    free(w.generators);
+    free(w.nodes);
+    free(w.inputs);
+    free(w.values);
+    return result;
+}
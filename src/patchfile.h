@@ -0,0 +1,95 @@
+#ifndef BLOOP_PATCHFILE
+#define BLOOP_PATCHFILE
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bloop.h"
+
+/*
+ * Patch files hold a generator graph in a binary format that is used as is
+ * after mapping the file into memory, so loading a patch costs the page
+ * faults of the parts that are read and nothing else:
+ *
+ *     header    bloop_patch_file_header
+ *     nodes     node_count bloop_patch_file_node records
+ *     inputs    input_count int32 node indices (-1 for no input, see
+ *               the optional inputs in patchfile.c)
+ *     values    value_count bloop_patch_file_value parameters
+ *
+ * Nodes are stored inputs first, so every input refers to an earlier node
+ * and the graph is built in a single pass over the nodes. Generators used
+ * by more than one consumer are stored once. Only the parameters passed to
+ * the constructors are stored, not the state of a running generator.
+ *
+ * All numbers are in the byte order of the machine that saved the file;
+ * files with another byte order or version are rejected.
+ *
+ *     bloop_patch_file_save(generator, "kick.bloop");
+ *
+ *     bloop_patch_file *f = bloop_patch_file_open("kick.bloop");
+ *     bloop_generator *g = bloop_patch_file_instantiate(f);
+ *     bloop_patch_file_close(f);
+ */
+
+#define BLOOP_PATCH_FILE_MAGIC "BLOP"
+#define BLOOP_PATCH_FILE_VERSION 1
+#define BLOOP_PATCH_FILE_BYTE_ORDER 0x01020304
+
+typedef struct bloop_patch_file_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t root;
+
+    uint32_t node_count;
+    uint32_t input_count;
+    uint32_t value_count;
+
+    // Byte offsets from the start of the file.
+    uint32_t nodes;
+    uint32_t inputs;
+    uint32_t values;
+} bloop_patch_file_header;
+
+// type is a bloop_generator_type. Its inputs are inputs[input_start] up to
+// input_start + input_count, its parameters likewise in values.
+typedef struct bloop_patch_file_node {
+    uint32_t type;
+    uint32_t input_start;
+    uint32_t input_count;
+    uint32_t value_start;
+    uint32_t value_count;
+} bloop_patch_file_node;
+
+typedef union bloop_patch_file_value {
+    float f;
+    int32_t i;
+} bloop_patch_file_value;
+
+typedef struct bloop_patch_file {
+    void *data;
+    size_t size;
+    const bloop_patch_file_header *header;
+    const bloop_patch_file_node *nodes;
+    const int32_t *inputs;
+    const bloop_patch_file_value *values;
+} bloop_patch_file;
+
+// Maps the file and checks its header; returns NULL if it can't be read or
+// isn't a patch file of this version.
+bloop_patch_file *bloop_patch_file_open(const char *path);
+void bloop_patch_file_close(bloop_patch_file *f);
+
+// Builds the graph with the allocator in use (see bloop_arena_use) and
+// returns its root, or NULL if the file is damaged. The graph doesn't refer
+// to the file, which can be closed right away.
+bloop_generator *bloop_patch_file_instantiate(bloop_patch_file *f);
+
+// Writes the graph below g; returns 0 on success and -1 if the file can't
+// be written or the graph has generators that can't be stored (voices,
+// samples, convolutions and generators with more than one output).
+// Safe to call while the audio thread is playing g: parameters are saved
+// with their latest value.
+int bloop_patch_file_save(bloop_generator *g, const char *path);
+
+#endif
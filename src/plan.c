@@ -0,0 +1,490 @@
+#include <stdlib.h>
+#include <string.h>
+#include "plan.h"
+#include "profile.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Tracks every generator of the region (the root or a body) that is being
+// compiled, so generators with more than one consumer get a single operation
+// whose slot is kept until the last consumer has been emitted.
+typedef struct bloop_plan_node {
+    bloop_generator *g;
+    int slot;
+    int uses;
+} bloop_plan_node;
+
+typedef struct bloop_plan_builder {
+    bloop_plan *plan;
+    int op_capacity;
+    int *free_slots;
+    int free_count;
+    int free_capacity;
+
+    bloop_plan_node *nodes;
+    int node_count;
+    int node_capacity;
+    int region_start;
+
+    // Constants don't get an operation: every distinct value gets a slot of
+    // its own that is filled once and never released.
+    float *constants;
+    int *constant_slots;
+    int constant_count;
+} bloop_plan_builder;
+
+static int bloop_plan_alloc_slot(bloop_plan_builder *b) {
+    if (b->free_count > 0) {
+        return b->free_slots[--b->free_count];
+    }
+    return b->plan->slot_count++;
+}
+
+static int bloop_plan_is_constant_slot(bloop_plan_builder *b, int slot) {
+    for (int i = 0; i < b->constant_count; i++) {
+        if (b->constant_slots[i] == slot) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void bloop_plan_release_slot(bloop_plan_builder *b, int slot) {
+    if (bloop_plan_is_constant_slot(b, slot)) {
+        return;
+    }
+    if (b->free_count == b->free_capacity) {
+        b->free_capacity = b->free_capacity == 0 ? 16 : b->free_capacity * 2;
+        b->free_slots = realloc(b->free_slots, sizeof(int) * b->free_capacity);
+    }
+    b->free_slots[b->free_count++] = slot;
+}
+
+static bloop_plan_node *bloop_plan_find_node(bloop_plan_builder *b, bloop_generator *g) {
+    for (int i = b->region_start; i < b->node_count; i++) {
+        if (b->nodes[i].g == g) {
+            return &b->nodes[i];
+        }
+    }
+    return NULL;
+}
+
+// Counts how often every generator in the region starting at g is used.
+// Inputs of segment generators live in regions of their own.
+static void bloop_plan_count_uses(bloop_plan_builder *b, bloop_generator *g) {
+    bloop_plan_node *node = bloop_plan_find_node(b, g);
+    if (node != NULL) {
+        node->uses++;
+        return;
+    }
+    if (b->node_count == b->node_capacity) {
+        b->node_capacity = b->node_capacity == 0 ? 32 : b->node_capacity * 2;
+        b->nodes = realloc(b->nodes, sizeof(bloop_plan_node) * b->node_capacity);
+    }
+    b->nodes[b->node_count++] = (bloop_plan_node) { g, -1, 1 };
+    if (g->segment_fn != NULL || g->block_fn == NULL) {
+        return;
+    }
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] != NULL) {
+            bloop_plan_count_uses(b, g->inputs[i]);
+        }
+    }
+}
+
+// Called by every consumer of g once it has been emitted.
+static void bloop_plan_consume(bloop_plan_builder *b, bloop_generator *g) {
+    bloop_plan_node *node = bloop_plan_find_node(b, g);
+    if (--node->uses == 0) {
+        bloop_plan_release_slot(b, node->slot);
+    }
+}
+
+static int bloop_plan_compile_(bloop_plan_builder *b, bloop_generator *g);
+static int bloop_plan_emit(bloop_plan_builder *b, bloop_generator *g);
+
+// Compiles g into a region of its own and returns the slot of its output,
+// which is released right away: the caller copies it before anything else
+// can be written to it.
+static int bloop_plan_compile_region(bloop_plan_builder *b, bloop_generator *g) {
+    int region_start = b->region_start;
+    int node_count = b->node_count;
+    b->region_start = node_count;
+    bloop_plan_count_uses(b, g);
+    int slot = bloop_plan_compile_(b, g);
+    bloop_plan_consume(b, g);
+    b->region_start = region_start;
+    b->node_count = node_count;
+    return slot;
+}
+
+static int bloop_plan_add_op(bloop_plan_builder *b, bloop_generator *g) {
+    bloop_plan *plan = b->plan;
+    if (plan->op_count == b->op_capacity) {
+        b->op_capacity = b->op_capacity == 0 ? 32 : b->op_capacity * 2;
+        plan->ops = realloc(plan->ops, sizeof(bloop_plan_op) * b->op_capacity);
+    }
+    bloop_plan_op *op = &plan->ops[plan->op_count];
+    memset(op, 0, sizeof(*op));
+    op->g = g;
+    op->block_fn = g->block_fn;
+    op->userData = g->userData;
+    op->out_slot = -1;
+    int count = g->input_count > 0 ? g->input_count : 1;
+    op->inputs = calloc(count, sizeof(float *));
+    op->input_slots = malloc(sizeof(int) * count * 3);
+    op->body_start = op->input_slots + count;
+    op->body_end = op->input_slots + count * 2;
+    for (int i = 0; i < count; i++) {
+        op->input_slots[i] = -1;
+    }
+    return plan->op_count++;
+}
+
+// Emits the operations for g and its inputs, unless that already happened
+// for another consumer, and returns the slot holding the output of g. The
+// slot stays allocated until every consumer has called bloop_plan_consume.
+static int bloop_plan_compile_(bloop_plan_builder *b, bloop_generator *g) {
+    int node = bloop_plan_find_node(b, g) - b->nodes;
+    if (b->nodes[node].slot < 0) {
+        int slot = bloop_plan_emit(b, g);
+        b->nodes[node].slot = slot;
+    }
+    return b->nodes[node].slot;
+}
+
+static int bloop_plan_constant_slot(bloop_plan_builder *b, float value) {
+    for (int i = 0; i < b->constant_count; i++) {
+        if (b->constants[i] == value) {
+            return b->constant_slots[i];
+        }
+    }
+    b->constants = realloc(b->constants, sizeof(float) * (b->constant_count + 1));
+    b->constant_slots = realloc(b->constant_slots, sizeof(int) * (b->constant_count + 1));
+    b->constants[b->constant_count] = value;
+    b->constant_slots[b->constant_count] = b->plan->slot_count++;
+    return b->constant_slots[b->constant_count++];
+}
+
+// Every check of an average gets a mark of its own, so the marks of earlier
+// checks never have to be cleared.
+static unsigned int bloop_plan_mark_counter = 0;
+
+// Marks g and every generator it depends on as part of input branch of the
+// average being checked. Returns how many of them weren't marked yet, or -1
+// when one of them is part of another input.
+static int bloop_plan_mark(bloop_generator *g, unsigned int mark, int branch) {
+    if (g->meta->plan_mark == mark) {
+        return g->meta->plan_branch == branch ? 0 : -1;
+    }
+    g->meta->plan_mark = mark;
+    g->meta->plan_branch = branch;
+    int count = 1;
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] != NULL) {
+            int c = bloop_plan_mark(g->inputs[i], mark, branch);
+            if (c < 0) {
+                return -1;
+            }
+            count += c;
+        }
+    }
+    return count;
+}
+
+// An average can be rendered in parallel when its inputs don't share any
+// generators, and at least two of them are worth a task of their own.
+static int bloop_plan_is_parallel(bloop_generator *g) {
+    if (g->type != BLOOP_AVERAGE || g->block_fn == NULL || g->input_count < 2) {
+        return 0;
+    }
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] == NULL) {
+            return 0;
+        }
+    }
+    unsigned int mark = ++bloop_plan_mark_counter;
+    int big = 0;
+    for (int i = 0; i < g->input_count; i++) {
+        int count = bloop_plan_mark(g->inputs[i], mark, i);
+        if (count < 0) {
+            return 0;
+        }
+        big += count >= BLOOP_PARALLEL_MIN_GENERATORS;
+    }
+    return big >= 2;
+}
+
+static int bloop_plan_emit_parallel(bloop_plan_builder *b, bloop_generator *g) {
+    int index = bloop_plan_add_op(b, g);
+    b->plan->ops[index].parallel = 1;
+
+    // Every body gets a fresh set of free slots, so no two bodies write to the
+    // same slot. The slots they release are pooled again afterwards.
+    int *free_slots = b->free_slots;
+    int free_count = b->free_count;
+    int free_capacity = b->free_capacity;
+    int **released = malloc(sizeof(int *) * g->input_count);
+    int *released_count = malloc(sizeof(int) * g->input_count);
+    for (int i = 0; i < g->input_count; i++) {
+        b->free_slots = NULL;
+        b->free_count = 0;
+        b->free_capacity = 0;
+        int start = b->plan->op_count;
+        int slot = bloop_plan_compile_(b, g->inputs[i]);
+        bloop_plan_op *op = &b->plan->ops[index];
+        op->input_slots[i] = slot;
+        op->body_start[i] = start;
+        op->body_end[i] = b->plan->op_count;
+        released[i] = b->free_slots;
+        released_count[i] = b->free_count;
+    }
+    b->free_slots = free_slots;
+    b->free_count = free_count;
+    b->free_capacity = free_capacity;
+    for (int i = 0; i < g->input_count; i++) {
+        for (int j = 0; j < released_count[i]; j++) {
+            bloop_plan_release_slot(b, released[i][j]);
+        }
+        free(released[i]);
+    }
+    free(released);
+    free(released_count);
+
+    int out = bloop_plan_alloc_slot(b);
+    bloop_plan_op *op = &b->plan->ops[index];
+    op->out_slot = out;
+    op->next = b->plan->op_count;
+    for (int i = 0; i < g->input_count; i++) {
+        bloop_plan_consume(b, g->inputs[i]);
+    }
+    return out;
+}
+
+static int bloop_plan_emit(bloop_plan_builder *b, bloop_generator *g) {
+    if (g->type == BLOOP_CONSTANT) {
+        return bloop_plan_constant_slot(b, *(float *)g->userData);
+    }
+    if (g->segment_fn != NULL) {
+        int index = bloop_plan_add_op(b, g);
+        int out = bloop_plan_alloc_slot(b);
+        b->plan->ops[index].out_slot = out;
+        for (int i = 0; i < g->input_count; i++) {
+            int start = b->plan->op_count;
+            int slot = -1;
+            if (g->inputs[i] != NULL) {
+                slot = bloop_plan_compile_region(b, g->inputs[i]);
+            }
+            bloop_plan_op *op = &b->plan->ops[index];
+            op->input_slots[i] = slot;
+            op->body_start[i] = start;
+            op->body_end[i] = b->plan->op_count;
+        }
+        b->plan->ops[index].next = b->plan->op_count;
+        return out;
+    }
+
+    if (bloop_plan_is_parallel(g)) {
+        return bloop_plan_emit_parallel(b, g);
+    }
+
+    // Generators without a block function render their inputs themselves.
+    int *input_slots = malloc(sizeof(int) * (g->input_count + 1));
+    for (int i = 0; i < g->input_count; i++) {
+        input_slots[i] = -1;
+        if (g->block_fn != NULL && g->inputs[i] != NULL) {
+            input_slots[i] = bloop_plan_compile_(b, g->inputs[i]);
+        }
+    }
+    int index = bloop_plan_add_op(b, g);
+    int out = bloop_plan_alloc_slot(b);
+    bloop_plan_op *op = &b->plan->ops[index];
+    op->out_slot = out;
+    op->next = index + 1;
+    for (int i = 0; i < g->input_count; i++) {
+        op->input_slots[i] = input_slots[i];
+        if (input_slots[i] >= 0) {
+            bloop_plan_consume(b, g->inputs[i]);
+        }
+    }
+    free(input_slots);
+    return out;
+}
+
+static void bloop_plan_exec(bloop_plan *plan, int from, int to, int n, bloop_tick tick);
+
+static void bloop_plan_branch_run(void *arg) {
+    bloop_plan_branch *branch = (bloop_plan_branch *) arg;
+    bloop_plan_exec(branch->plan, branch->from, branch->to, branch->n, branch->tick);
+}
+
+bloop_plan *bloop_plan_compile(bloop_generator *root) {
+    return bloop_plan_compile_channels(1, &root);
+}
+
+bloop_plan *bloop_plan_compile_channels(int channels, bloop_generator **roots) {
+    bloop_plan *plan = malloc(sizeof(*plan));
+    plan->op_count = 0;
+    plan->ops = NULL;
+    plan->slot_count = 0;
+    plan->channels = channels;
+    plan->outs = malloc(sizeof(float *) * channels);
+
+    // All roots are compiled into the same region, so generators they share
+    // get a single operation. Their slots are never released, as all of them
+    // are read once the whole plan has run.
+    bloop_plan_builder b = { plan, 0, NULL, 0, 0, NULL, 0, 0, 0, NULL, NULL, 0 };
+    int *outs = malloc(sizeof(int) * channels);
+    for (int c = 0; c < channels; c++) {
+        bloop_plan_count_uses(&b, roots[c]);
+    }
+    for (int c = 0; c < channels; c++) {
+        outs[c] = bloop_plan_compile_(&b, roots[c]);
+    }
+
+    plan->slots = malloc(sizeof(float) * BLOOP_MAX_BLOCK * plan->slot_count);
+    for (int i = 0; i < b.constant_count; i++) {
+        float *slot = plan->slots + b.constant_slots[i] * BLOOP_MAX_BLOCK;
+        for (int j = 0; j < BLOOP_MAX_BLOCK; j++) {
+            slot[j] = b.constants[i];
+        }
+    }
+    free(b.free_slots);
+    free(b.nodes);
+    free(b.constants);
+    free(b.constant_slots);
+    for (int c = 0; c < channels; c++) {
+        plan->outs[c] = plan->slots + outs[c] * BLOOP_MAX_BLOCK;
+    }
+    free(outs);
+    for (int i = 0; i < plan->op_count; i++) {
+        bloop_plan_op *op = &plan->ops[i];
+        op->out = plan->slots + op->out_slot * BLOOP_MAX_BLOCK;
+        for (int j = 0; j < op->g->input_count; j++) {
+            op->inputs[j] = NULL;
+            if (op->input_slots[j] >= 0) {
+                op->inputs[j] = plan->slots + op->input_slots[j] * BLOOP_MAX_BLOCK;
+            }
+        }
+        if (op->parallel) {
+            op->branches = malloc(sizeof(bloop_plan_branch) * op->g->input_count);
+            op->tasks = malloc(sizeof(bloop_task *) * op->g->input_count);
+            for (int j = 0; j < op->g->input_count; j++) {
+                bloop_plan_branch *branch = &op->branches[j];
+                branch->task.fn = bloop_plan_branch_run;
+                branch->task.arg = branch;
+                branch->plan = plan;
+                branch->from = op->body_start[j];
+                branch->to = op->body_end[j];
+                op->tasks[j] = &branch->task;
+            }
+        }
+    }
+    return plan;
+}
+
+static void bloop_plan_exec(bloop_plan *plan, int from, int to, int n, bloop_tick tick) {
+    int i = from;
+    while (i < to) {
+        bloop_plan_op *op = &plan->ops[i];
+        if (op->parallel) {
+            for (int j = 0; j < op->g->input_count; j++) {
+                op->branches[j].n = n;
+                op->branches[j].tick = tick;
+            }
+            bloop_pool_run(op->tasks, op->g->input_count);
+            uint64_t start = bloop_profile_begin();
+            op->block_fn(op->g, op->userData, op->inputs, op->out, n, tick);
+            bloop_profile_end(op->g, start);
+        } else if (op->block_fn != NULL) {
+            uint64_t start = bloop_profile_begin();
+            op->block_fn(op->g, op->userData, op->inputs, op->out, n, tick);
+            bloop_profile_end(op->g, start);
+        } else if (op->g->segment_fn != NULL) {
+            bloop_generator *g = op->g;
+            int done = 0;
+            uint64_t start = bloop_profile_begin();
+            while (done < n) {
+                int input = -1;
+                bloop_tick input_tick = 0;
+                int len = g->segment_fn(g, op->userData, tick + done, n - done, &input, &input_tick);
+                if (input < 0 || op->inputs[input] == NULL) {
+                    memset(op->out + done, 0, sizeof(float) * len);
+                } else {
+                    bloop_profile_end(g, start);
+                    bloop_plan_exec(plan, op->body_start[input], op->body_end[input], len, input_tick);
+                    start = bloop_profile_begin();
+                    memcpy(op->out + done, op->inputs[input], sizeof(float) * len);
+                }
+                done += len;
+            }
+            bloop_profile_end(g, start);
+        } else {
+            uint64_t start = bloop_profile_begin();
+            for (int j = 0; j < n; j++) {
+                op->out[j] = bloop_run(op->g, tick + j);
+            }
+            bloop_profile_end(op->g, start);
+        }
+        i = op->next;
+    }
+}
+
+void bloop_plan_run(bloop_plan *plan, float *out, int frames, bloop_tick tick) {
+    for (int i = 0; i < frames; i += BLOOP_MAX_BLOCK) {
+        int n = frames - i < BLOOP_MAX_BLOCK ? frames - i : BLOOP_MAX_BLOCK;
+        bloop_plan_exec(plan, 0, plan->op_count, n, tick + i);
+        memcpy(out + i, plan->outs[0], sizeof(float) * n);
+    }
+}
+
+// Interleaves n samples of every channel into out.
+static void bloop_plan_interleave(bloop_plan *plan, float *out, int n, int channels) {
+    if (channels == 2 && plan->channels == 2) {
+        float *left = plan->outs[0];
+        float *right = plan->outs[1];
+        int i = 0;
+#if defined(__SSE2__)
+        for (; i + 4 <= n; i += 4) {
+            __m128 l = _mm_loadu_ps(left + i);
+            __m128 r = _mm_loadu_ps(right + i);
+            _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+        }
+#endif
+        for (; i < n; i++) {
+            out[2 * i] = left[i];
+            out[2 * i + 1] = right[i];
+        }
+        return;
+    }
+    for (int c = 0; c < channels; c++) {
+        float *in = plan->outs[c % plan->channels];
+        for (int i = 0; i < n; i++) {
+            out[i * channels + c] = in[i];
+        }
+    }
+}
+
+void bloop_plan_run_interleaved(bloop_plan *plan, float *out, int frames, int channels, bloop_tick tick) {
+    for (int i = 0; i < frames; i += BLOOP_MAX_BLOCK) {
+        int n = frames - i < BLOOP_MAX_BLOCK ? frames - i : BLOOP_MAX_BLOCK;
+        bloop_plan_exec(plan, 0, plan->op_count, n, tick + i);
+        bloop_plan_interleave(plan, out + i * channels, n, channels);
+    }
+}
+
+void bloop_plan_free(bloop_plan *plan) {
+    for (int i = 0; i < plan->op_count; i++) {
+        free(plan->ops[i].inputs);
+        free(plan->ops[i].input_slots);
+        free(plan->ops[i].branches);
+        free(plan->ops[i].tasks);
+    }
+    free(plan->ops);
+    free(plan->slots);
+    free(plan->outs);
+    free(plan);
+}
@@ -0,0 +1,99 @@
+#ifndef BLOOP_PLAN
+#define BLOOP_PLAN
+
+#include "bloop.h"
+#include "pool.h"
+
+/*
+ * A bloop_plan is a generator tree compiled into a flat list of operations in
+ * evaluation order. Every operation renders one generator into a preassigned
+ * scratch buffer (a slot) and reads its inputs from the slots of the
+ * operations that came before it, so running a plan is a single loop instead
+ * of a recursive walk through the inputs of every generator.
+ *
+ * Generators with a segment function (repeat, offset, sequence) play their
+ * inputs at different ticks. Every input of such a generator is compiled
+ * into a body: a range of operations directly following the segment
+ * operation, which is executed once for every segment and skipped by the
+ * main loop.
+ *
+ * Generators used by more than one consumer in the same region (the root or
+ * a body) get a single operation, and its slot is kept alive until the last
+ * consumer has run.
+ *
+ * Constants don't get an operation at all: their slot is filled once when the
+ * plan is compiled.
+ *
+ * Averages whose inputs don't share any generators are compiled into
+ * parallel operations: like segment operations, every input gets a body
+ * following the operation, and no two bodies share a slot. The bodies run as
+ * tasks on the bloop_pool (when it has been started) and the average is
+ * computed once all of them are done.
+ *
+ * Plans use the same block functions as bloop_run_block and produce the same
+ * output.
+ */
+
+// Parallel operations need inputs that each depend on at least this many
+// generators.
+#define BLOOP_PARALLEL_MIN_GENERATORS 8
+
+struct bloop_plan;
+
+// A body of a parallel operation, run as a task.
+typedef struct bloop_plan_branch {
+    bloop_task task;
+    struct bloop_plan *plan;
+    int from;
+    int to;
+    int n;
+    bloop_tick tick;
+} bloop_plan_branch;
+
+typedef struct bloop_plan_op {
+    bloop_generator *g;
+    void (*block_fn)(struct bloop_generator *, void*, float **, float *, int, bloop_tick);
+    void *userData;
+
+    // All input arrays have an entry for every input of g.
+    float *out;
+    float **inputs;
+    int out_slot;
+    int *input_slots;
+
+    // Segment and parallel operations only: the operations rendering input i
+    // are body_start[i] up to body_end[i], and next is the index of the first
+    // operation after all the bodies.
+    int *body_start;
+    int *body_end;
+    int next;
+
+    int parallel;
+    bloop_plan_branch *branches;
+    bloop_task **tasks;
+} bloop_plan_op;
+
+typedef struct bloop_plan {
+    int op_count;
+    bloop_plan_op *ops;
+
+    int slot_count;
+    float *slots;
+    // The output block of every channel.
+    int channels;
+    float **outs;
+} bloop_plan;
+
+bloop_plan *bloop_plan_compile(bloop_generator *root);
+// Compiles a plan with a root for every output channel; generators shared by
+// the roots are rendered once.
+bloop_plan *bloop_plan_compile_channels(int channels, bloop_generator **roots);
+// Renders the first channel.
+void bloop_plan_run(bloop_plan *plan, float *out, int frames, bloop_tick tick);
+// Renders interleaved frames of channels samples. Output channel c plays
+// channel c of the plan, wrapping around if the plan has fewer channels, so
+// a mono plan plays on every channel.
+void bloop_plan_run_interleaved(bloop_plan *plan, float *out, int frames, int channels, bloop_tick tick);
+void bloop_plan_free(bloop_plan *plan);
+
+#endif
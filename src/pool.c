@@ -0,0 +1,238 @@
+#include <stdlib.h>
+#include "pool.h"
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define BLOOP_NO_THREADS
+#endif
+#if defined(_WIN32)
+#define BLOOP_NO_THREADS
+#endif
+
+#ifdef BLOOP_NO_THREADS
+
+int bloop_pool_start(int workers) {
+    return 0;
+}
+
+void bloop_pool_stop(void) {
+}
+
+int bloop_pool_workers(void) {
+    return 0;
+}
+
+void bloop_pool_run(bloop_task **tasks, int count) {
+    for (int i = 0; i < count; i++) {
+        tasks[i]->fn(tasks[i]->arg);
+    }
+}
+
+#else
+
+#include <pthread.h>
+#include <sched.h>
+#ifdef __APPLE__
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+
+#define BLOOP_POOL_SPIN 4096
+
+typedef struct bloop_pool {
+    // Grows while bloop_pool_start starts workers, which already steal.
+    atomic_int workers;
+    atomic_int running;
+    atomic_int sleeping;
+    pthread_t threads[BLOOP_POOL_MAX_WORKERS];
+    // Deque 0 belongs to the thread calling bloop_pool_run.
+    bloop_deque deques[BLOOP_POOL_MAX_WORKERS + 1];
+#ifdef __APPLE__
+    dispatch_semaphore_t wake;
+#else
+    sem_t wake;
+#endif
+} bloop_pool;
+
+static bloop_pool pool;
+static _Thread_local int bloop_worker_id = 0;
+
+static int bloop_deque_push(bloop_deque *d, bloop_task *task) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - t >= BLOOP_DEQUE_SIZE) {
+        return 0;
+    }
+    atomic_store_explicit(&d->tasks[b % BLOOP_DEQUE_SIZE], task, memory_order_relaxed);
+    // A release store rather than a fence: the same ordering, and one that
+    // ThreadSanitizer understands.
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_release);
+    return 1;
+}
+
+static bloop_task *bloop_deque_pop(bloop_deque *d) {
+    long b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    long t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if (t > b) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    bloop_task *task = atomic_load_explicit(&d->tasks[b % BLOOP_DEQUE_SIZE], memory_order_relaxed);
+    if (t == b) {
+        // The last task; race the thieves for it.
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+static bloop_task *bloop_deque_steal(bloop_deque *d) {
+    long t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    long b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if (t >= b) {
+        return NULL;
+    }
+    bloop_task *task = atomic_load_explicit(&d->tasks[t % BLOOP_DEQUE_SIZE], memory_order_relaxed);
+    if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)) {
+        return NULL;
+    }
+    return task;
+}
+
+static void bloop_task_run(bloop_task *task) {
+    task->fn(task->arg);
+    atomic_fetch_sub_explicit(task->pending, 1, memory_order_release);
+}
+
+// Pops a task from the deque of the calling worker, or steals one from the
+// others, starting with the next worker along.
+static bloop_task *bloop_pool_find_task(void) {
+    bloop_task *task = bloop_deque_pop(&pool.deques[bloop_worker_id]);
+    int workers = atomic_load_explicit(&pool.workers, memory_order_relaxed);
+    for (int i = 1; task == NULL && i <= workers; i++) {
+        task = bloop_deque_steal(&pool.deques[(bloop_worker_id + i) % (workers + 1)]);
+    }
+    return task;
+}
+
+static void bloop_pool_wake(int count) {
+    int sleeping = atomic_load_explicit(&pool.sleeping, memory_order_acquire);
+    for (int i = 0; i < count && i < sleeping; i++) {
+#ifdef __APPLE__
+        dispatch_semaphore_signal(pool.wake);
+#else
+        sem_post(&pool.wake);
+#endif
+    }
+}
+
+static void *bloop_pool_worker(void *arg) {
+    bloop_worker_id = (int)(long)arg;
+    int idle = 0;
+    while (atomic_load_explicit(&pool.running, memory_order_acquire)) {
+        bloop_task *task = bloop_pool_find_task();
+        if (task != NULL) {
+            bloop_task_run(task);
+            idle = 0;
+            continue;
+        }
+        if (++idle < BLOOP_POOL_SPIN) {
+            sched_yield();
+            continue;
+        }
+        atomic_fetch_add(&pool.sleeping, 1);
+#ifdef __APPLE__
+        dispatch_semaphore_wait(pool.wake, DISPATCH_TIME_FOREVER);
+#else
+        sem_wait(&pool.wake);
+#endif
+        atomic_fetch_sub(&pool.sleeping, 1);
+        idle = 0;
+    }
+    return NULL;
+}
+
+int bloop_pool_start(int workers) {
+    if (atomic_load(&pool.workers) > 0) {
+        return atomic_load(&pool.workers);
+    }
+    if (workers > BLOOP_POOL_MAX_WORKERS) {
+        workers = BLOOP_POOL_MAX_WORKERS;
+    }
+    atomic_store(&pool.running, 1);
+    atomic_store(&pool.sleeping, 0);
+#ifdef __APPLE__
+    pool.wake = dispatch_semaphore_create(0);
+#else
+    sem_init(&pool.wake, 0, 0);
+#endif
+    for (int i = 0; i < workers; i++) {
+        if (pthread_create(&pool.threads[i], NULL, bloop_pool_worker, (void *)(long)(i + 1)) != 0) {
+            break;
+        }
+        atomic_fetch_add(&pool.workers, 1);
+    }
+    return atomic_load(&pool.workers);
+}
+
+void bloop_pool_stop(void) {
+    int workers = atomic_load(&pool.workers);
+    atomic_store(&pool.running, 0);
+    for (int i = 0; i < workers; i++) {
+#ifdef __APPLE__
+        dispatch_semaphore_signal(pool.wake);
+#else
+        sem_post(&pool.wake);
+#endif
+    }
+    for (int i = 0; i < workers; i++) {
+        pthread_join(pool.threads[i], NULL);
+    }
+    atomic_store(&pool.workers, 0);
+}
+
+int bloop_pool_workers(void) {
+    return atomic_load(&pool.workers);
+}
+
+void bloop_pool_run(bloop_task **tasks, int count) {
+    atomic_int pending;
+    atomic_init(&pending, count);
+    for (int i = 0; i < count; i++) {
+        tasks[i]->pending = &pending;
+    }
+    if (atomic_load_explicit(&pool.workers, memory_order_relaxed) == 0) {
+        for (int i = 0; i < count; i++) {
+            bloop_task_run(tasks[i]);
+        }
+        return;
+    }
+
+    bloop_deque *own = &pool.deques[bloop_worker_id];
+    int pushed = 0;
+    for (int i = count - 1; i >= 1; i--) {
+        if (bloop_deque_push(own, tasks[i])) {
+            pushed++;
+        } else {
+            bloop_task_run(tasks[i]);
+        }
+    }
+    bloop_pool_wake(pushed);
+    bloop_task_run(tasks[0]);
+
+    // Help out until every task is done; this may run tasks from other
+    // bloop_pool_run calls too, which is fine as they are independent.
+    while (atomic_load_explicit(&pending, memory_order_acquire) > 0) {
+        bloop_task *task = bloop_pool_find_task();
+        if (task != NULL) {
+            bloop_task_run(task);
+        }
+    }
+}
+
+#endif
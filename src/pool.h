@@ -0,0 +1,48 @@
+#ifndef BLOOP_POOL
+#define BLOOP_POOL
+
+#include <stdatomic.h>
+
+/*
+ * A fixed pool of worker threads with a work-stealing scheduler, used to
+ * render independent parts of a plan in parallel.
+ *
+ * Every worker owns a deque of tasks (a Chase-Lev deque): it pushes and pops
+ * tasks at the bottom, while idle workers steal from the top. The thread that
+ * calls bloop_pool_run (normally the audio thread) acts as worker 0: it pushes
+ * all but the first task, runs the first one itself and then keeps popping
+ * or stealing tasks until all of them are done, so it never blocks waiting for
+ * a worker. Tasks can call bloop_pool_run themselves to split up further.
+ *
+ * Idle workers spin for a while before they go to sleep on a semaphore;
+ * bloop_pool_run only posts that semaphore, which doesn't block.
+ *
+ * Only one thread outside the pool may call bloop_pool_run at a time. Without
+ * thread support (e.g. in the emscripten build) tasks run one after another.
+ */
+
+#define BLOOP_POOL_MAX_WORKERS 16
+#define BLOOP_DEQUE_SIZE 256
+
+typedef struct bloop_task {
+    void (*fn)(void *);
+    void *arg;
+    atomic_int *pending;
+} bloop_task;
+
+typedef struct bloop_deque {
+    atomic_long top;
+    atomic_long bottom;
+    _Atomic(bloop_task *) tasks[BLOOP_DEQUE_SIZE];
+} bloop_deque;
+
+// Starts workers threads next to the calling thread; returns the number of
+// threads that were started.
+int bloop_pool_start(int workers);
+void bloop_pool_stop(void);
+int bloop_pool_workers(void);
+
+// Runs all tasks and returns once every one of them has finished.
+void bloop_pool_run(bloop_task **tasks, int count);
+
+#endif
@@ -0,0 +1,64 @@
+#define SOKOL_IMPL
+#include "profile.h"
+
+int bloop_profile_enabled = 0;
+
+extern int SAMPLE_RATE;
+
+void bloop_profile_enable(int enabled) {
+    bloop_profile_enabled = enabled;
+}
+
+void bloop_stats_init(bloop_callback_stats *stats) {
+    atomic_init(&stats->callbacks, 0);
+    atomic_init(&stats->overruns, 0);
+    atomic_init(&stats->worst_time, 0);
+    atomic_init(&stats->worst_load, 0.0f);
+    atomic_init(&stats->load, 0.0f);
+    for (int i = 0; i < BLOOP_STATS_BUCKETS; i++) {
+        atomic_init(&stats->histogram[i], 0);
+    }
+}
+
+// Only the audio thread writes, so plain loads and stores are enough to
+// update the maximums and the average.
+void bloop_stats_record(bloop_callback_stats *stats, uint64_t time, int frames) {
+    double deadline = (double) frames / SAMPLE_RATE;
+    float load = (float)(100.0 * stm_sec(time) / deadline);
+
+    int bucket = (int)(load / BLOOP_STATS_BUCKET_LOAD);
+    bucket = bucket < BLOOP_STATS_BUCKETS ? bucket : BLOOP_STATS_BUCKETS - 1;
+    atomic_fetch_add_explicit(&stats->histogram[bucket], 1, memory_order_relaxed);
+    if (load >= 100.0f) {
+        atomic_fetch_add_explicit(&stats->overruns, 1, memory_order_relaxed);
+    }
+    if (time > atomic_load_explicit(&stats->worst_time, memory_order_relaxed)) {
+        atomic_store_explicit(&stats->worst_time, time, memory_order_relaxed);
+    }
+    if (load > atomic_load_explicit(&stats->worst_load, memory_order_relaxed)) {
+        atomic_store_explicit(&stats->worst_load, load, memory_order_relaxed);
+    }
+    float average = atomic_load_explicit(&stats->load, memory_order_relaxed);
+    if (atomic_fetch_add_explicit(&stats->callbacks, 1, memory_order_relaxed) == 0) {
+        average = load;
+    }
+    average += (load - average) * BLOOP_STATS_SMOOTHING;
+    atomic_store_explicit(&stats->load, average, memory_order_relaxed);
+}
+
+void bloop_stats_print(bloop_callback_stats *stats, FILE *f) {
+    fprintf(f, "callbacks %llu, overruns %llu, load %.1f%%, worst %.1f%% (%.3f ms)\n",
+            atomic_load(&stats->callbacks),
+            atomic_load(&stats->overruns),
+            atomic_load(&stats->load),
+            atomic_load(&stats->worst_load),
+            stm_ms(atomic_load(&stats->worst_time)));
+    for (int i = 0; i < BLOOP_STATS_BUCKETS; i++) {
+        unsigned long long count = atomic_load(&stats->histogram[i]);
+        if (i == BLOOP_STATS_BUCKETS - 1) {
+            fprintf(f, "  >=%3d%%     %llu\n", i * BLOOP_STATS_BUCKET_LOAD, count);
+        } else {
+            fprintf(f, "  %3d-%3d%%   %llu\n", i * BLOOP_STATS_BUCKET_LOAD, (i + 1) * BLOOP_STATS_BUCKET_LOAD, count);
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef BLOOP_PROFILE
+#define BLOOP_PROFILE
+
+#include <stdint.h>
+#include <stdio.h>
+#include "sokol_time.h"
+#include "bloop.h"
+
+/*
+ * Both the per generator profile and the callback stats are measured with
+ * sokol_time, so stm_setup has to be called before they are used.
+ *
+ * Optional per generator profiling. While it is enabled, the plan interpreter
+ * adds the time it spends in every operation to the profile_time of the
+ * generator (in sokol_time ticks). That is two stm_now calls per operation
+ * per block, cheap enough to leave on while playing.
+ *
+ * Only the generator's own work is counted: the time spent rendering the
+ * inputs of a segment generator or the branches of a parallel average is
+ * counted for those inputs.
+ */
+
+extern int bloop_profile_enabled;
+
+void bloop_profile_enable(int enabled);
+
+#define bloop_profile_begin() (bloop_profile_enabled ? stm_now() : 0)
+#define bloop_profile_end(g, start) do { \
+    if ((start) != 0) { \
+        atomic_fetch_add_explicit(&(g)->profile_time, stm_since(start), memory_order_relaxed); \
+    } \
+} while (0)
+
+/*
+ * Timing of the audio callback. The audio thread records how long every
+ * callback took against its deadline, the time it takes to play the frames
+ * it rendered, and any thread can read the stats while it is running.
+ *
+ * The load of a callback is its time as a percentage of the deadline; loads
+ * of 100% and more are overruns, which are heard as crackles. The histogram
+ * counts callbacks per BLOOP_STATS_BUCKET_LOAD percent of load, the last
+ * bucket holds everything from BLOOP_STATS_BUCKETS - 1 buckets up.
+ */
+
+#define BLOOP_STATS_BUCKETS 16
+#define BLOOP_STATS_BUCKET_LOAD 10
+// Weight of the latest callback in the moving average of the load.
+#define BLOOP_STATS_SMOOTHING 0.05f
+
+typedef struct bloop_callback_stats {
+    atomic_ullong callbacks;
+    atomic_ullong overruns;
+    // The longest callback, in sokol_time ticks, and the highest load.
+    atomic_ullong worst_time;
+    _Atomic float worst_load;
+    _Atomic float load;
+    atomic_ullong histogram[BLOOP_STATS_BUCKETS];
+} bloop_callback_stats;
+
+void bloop_stats_init(bloop_callback_stats *stats);
+// Called by the audio thread after rendering frames in time ticks.
+void bloop_stats_record(bloop_callback_stats *stats, uint64_t time, int frames);
+void bloop_stats_print(bloop_callback_stats *stats, FILE *f);
+
+#endif
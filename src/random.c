@@ -0,0 +1,108 @@
+#include "random.h"
+
+static uint32_t bloop_random_global_seed = 0;
+static uint32_t bloop_random_counter = 0;
+
+// 2^-23, scales the top 24 bits of a sample to [0, 2).
+#define BLOOP_RANDOM_SCALE (1.0f / 8388608.0f)
+
+static uint64_t bloop_splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+void bloop_random_seed_global(uint32_t seed) {
+    bloop_random_global_seed = seed;
+    bloop_random_counter = 0;
+}
+
+void bloop_random_init(bloop_random *r) {
+    r->seed = bloop_random_global_seed ^ (bloop_random_counter++ * 0x9e3779b9u);
+    bloop_random_reset(r);
+}
+
+void bloop_random_reset(bloop_random *r) {
+    uint64_t x = r->seed;
+    for (int lane = 0; lane < BLOOP_RANDOM_LANES; lane++) {
+        uint64_t a = bloop_splitmix64(&x);
+        uint64_t b = bloop_splitmix64(&x);
+        r->s[0][lane] = (uint32_t) a;
+        r->s[1][lane] = (uint32_t)(a >> 32);
+        r->s[2][lane] = (uint32_t) b;
+        r->s[3][lane] = (uint32_t)(b >> 32);
+    }
+    r->used = BLOOP_RANDOM_LANES;
+}
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+// Advances all lanes count times and writes 4 samples per step to out.
+static void bloop_random_steps(bloop_random *r, float *out, int count) {
+    __m128i s0 = _mm_loadu_si128((__m128i *) r->s[0]);
+    __m128i s1 = _mm_loadu_si128((__m128i *) r->s[1]);
+    __m128i s2 = _mm_loadu_si128((__m128i *) r->s[2]);
+    __m128i s3 = _mm_loadu_si128((__m128i *) r->s[3]);
+    const __m128 scale = _mm_set1_ps(BLOOP_RANDOM_SCALE);
+    const __m128 one = _mm_set1_ps(1.0f);
+    for (int i = 0; i < count; i++) {
+        __m128i result = _mm_srli_epi32(_mm_add_epi32(s0, s3), 8);
+        _mm_storeu_ps(out + i * 4, _mm_sub_ps(_mm_mul_ps(_mm_cvtepi32_ps(result), scale), one));
+        __m128i t = _mm_slli_epi32(s1, 9);
+        s2 = _mm_xor_si128(s2, s0);
+        s3 = _mm_xor_si128(s3, s1);
+        s1 = _mm_xor_si128(s1, s2);
+        s0 = _mm_xor_si128(s0, s3);
+        s2 = _mm_xor_si128(s2, t);
+        s3 = _mm_or_si128(_mm_slli_epi32(s3, 11), _mm_srli_epi32(s3, 21));
+    }
+    _mm_storeu_si128((__m128i *) r->s[0], s0);
+    _mm_storeu_si128((__m128i *) r->s[1], s1);
+    _mm_storeu_si128((__m128i *) r->s[2], s2);
+    _mm_storeu_si128((__m128i *) r->s[3], s3);
+}
+
+#else
+
+static void bloop_random_steps(bloop_random *r, float *out, int count) {
+    for (int i = 0; i < count; i++) {
+        for (int lane = 0; lane < BLOOP_RANDOM_LANES; lane++) {
+            uint32_t *s0 = &r->s[0][lane], *s1 = &r->s[1][lane];
+            uint32_t *s2 = &r->s[2][lane], *s3 = &r->s[3][lane];
+            uint32_t result = (*s0 + *s3) >> 8;
+            out[i * 4 + lane] = (float) result * BLOOP_RANDOM_SCALE - 1.0f;
+            uint32_t t = *s1 << 9;
+            *s2 ^= *s0;
+            *s3 ^= *s1;
+            *s1 ^= *s2;
+            *s0 ^= *s3;
+            *s2 ^= t;
+            *s3 = (*s3 << 11) | (*s3 >> 21);
+        }
+    }
+}
+
+#endif
+
+float bloop_random_next(bloop_random *r) {
+    if (r->used == BLOOP_RANDOM_LANES) {
+        bloop_random_steps(r, r->buffer, 1);
+        r->used = 0;
+    }
+    return r->buffer[r->used++];
+}
+
+void bloop_random_fill(bloop_random *r, float *out, int n) {
+    int i = 0;
+    while (i < n && r->used < BLOOP_RANDOM_LANES) {
+        out[i++] = r->buffer[r->used++];
+    }
+    int steps = (n - i) / BLOOP_RANDOM_LANES;
+    bloop_random_steps(r, out + i, steps);
+    i += steps * BLOOP_RANDOM_LANES;
+    while (i < n) {
+        out[i++] = bloop_random_next(r);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef BLOOP_RANDOM
+#define BLOOP_RANDOM
+
+#include <stdint.h>
+
+/*
+ * Noise for generators that need it, without the shared state of rand().
+ *
+ * Every state runs four independent xoshiro128+ generators side by side, one
+ * per SIMD lane; samples are taken from the lanes in turn. States are seeded
+ * from the global seed (see bloop_random_seed_global) and a counter, so
+ * building the same patch after setting the same global seed produces the
+ * same noise, whatever thread renders it.
+ *
+ * Samples are uniform in [-1, 1). The SIMD and scalar paths perform the same
+ * integer operations, so they produce identical samples.
+ */
+
+#define BLOOP_RANDOM_LANES 4
+
+typedef struct bloop_random {
+    uint32_t s[4][BLOOP_RANDOM_LANES];
+    uint32_t seed;
+    // Samples of the last step that haven't been used yet.
+    float buffer[BLOOP_RANDOM_LANES];
+    int used;
+} bloop_random;
+
+// Seeds every state that is initialised from now on.
+void bloop_random_seed_global(uint32_t seed);
+
+// Initialises r with the next seed, derived from the global seed.
+void bloop_random_init(bloop_random *r);
+// Goes back to the first sample after bloop_random_init.
+void bloop_random_reset(bloop_random *r);
+
+float bloop_random_next(bloop_random *r);
+void bloop_random_fill(bloop_random *r, float *out, int n);
+
+#endif
@@ -0,0 +1,401 @@
+#include <fcntl.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "sample.h"
+#include "arena.h"
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define BLOOP_NO_THREADS
+#endif
+
+#ifndef BLOOP_NO_THREADS
+#include <pthread.h>
+#endif
+
+extern int SAMPLE_RATE;
+
+static uint32_t bloop_sample_u16(const uint8_t *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t bloop_sample_u32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int bloop_sample_frame_size(enum bloop_sample_format format, int channels) {
+    switch (format) {
+        case BLOOP_SAMPLE_S16:
+            return 2 * channels;
+        case BLOOP_SAMPLE_S24:
+            return 3 * channels;
+        case BLOOP_SAMPLE_F32:
+            return 4 * channels;
+    }
+    return 0;
+}
+
+static bloop_sample_file *bloop_sample_map(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    bloop_sample_file *file = malloc(sizeof(*file));
+    file->data = data;
+    file->size = st.st_size;
+    return file;
+}
+
+// Sets up the samples of a mapped file and asks for its start to be read.
+static bloop_sample_file *bloop_sample_init(bloop_sample_file *file, size_t offset, size_t size, enum bloop_sample_format format, int channels, int rate) {
+    if (channels <= 0 || rate <= 0 || offset > file->size || bloop_sample_frame_size(format, 1) == 0) {
+        bloop_sample_close(file);
+        return NULL;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+    file->samples = (const uint8_t *) file->data + offset;
+    file->format = format;
+    file->channels = channels;
+    file->rate = rate;
+    file->frame_size = bloop_sample_frame_size(format, channels);
+    file->frames = size / file->frame_size;
+
+    size_t head = (size_t)BLOOP_SAMPLE_PREFETCH_FRAMES * file->frame_size;
+    madvise(file->data, offset + (size < head ? size : head), MADV_WILLNEED);
+    return file;
+}
+
+bloop_sample_file *bloop_sample_open_raw(const char *path, enum bloop_sample_format format, int channels, int rate) {
+    bloop_sample_file *file = bloop_sample_map(path);
+    if (file == NULL) {
+        return NULL;
+    }
+    return bloop_sample_init(file, 0, file->size, format, channels, rate);
+}
+
+bloop_sample_file *bloop_sample_open(const char *path) {
+    bloop_sample_file *file = bloop_sample_map(path);
+    if (file == NULL) {
+        return NULL;
+    }
+    const uint8_t *p = (const uint8_t *) file->data;
+    if (file->size < 12 || memcmp(p, "RIFF", 4) != 0 || memcmp(p + 8, "WAVE", 4) != 0) {
+        bloop_sample_close(file);
+        return NULL;
+    }
+
+    int tag = 0, channels = 0, rate = 0, bits = 0;
+    size_t data = 0, data_size = 0;
+    size_t offset = 12;
+    while (offset + 8 <= file->size) {
+        const uint8_t *chunk = p + offset;
+        size_t size = bloop_sample_u32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16 && offset + 8 + size <= file->size) {
+            tag = bloop_sample_u16(chunk + 8);
+            channels = bloop_sample_u16(chunk + 10);
+            rate = bloop_sample_u32(chunk + 12);
+            bits = bloop_sample_u16(chunk + 22);
+            // WAVE_FORMAT_EXTENSIBLE keeps the actual tag in its subformat.
+            if (tag == 0xfffe && size >= 26) {
+                tag = bloop_sample_u16(chunk + 32);
+            }
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            data = offset + 8;
+            data_size = size;
+            break;
+        }
+        offset += 8 + size + (size & 1);
+    }
+
+    if (data > 0 && tag == 1 && bits == 16) {
+        return bloop_sample_init(file, data, data_size, BLOOP_SAMPLE_S16, channels, rate);
+    }
+    if (data > 0 && tag == 1 && bits == 24) {
+        return bloop_sample_init(file, data, data_size, BLOOP_SAMPLE_S24, channels, rate);
+    }
+    if (data > 0 && tag == 3 && bits == 32) {
+        return bloop_sample_init(file, data, data_size, BLOOP_SAMPLE_F32, channels, rate);
+    }
+    bloop_sample_close(file);
+    return NULL;
+}
+
+static void bloop_sample_forget(bloop_sample_file *file);
+
+void bloop_sample_close(bloop_sample_file *file) {
+    bloop_sample_forget(file);
+    munmap(file->data, file->size);
+    free(file);
+}
+
+// A frame mixed down to mono, or silence outside the file.
+static inline float bloop_sample_read(const bloop_sample_file *file, int64_t frame) {
+    if (frame < 0 || frame >= file->frames) {
+        return 0.0;
+    }
+    const uint8_t *p = file->samples + frame * file->frame_size;
+    float s = 0.0;
+    for (int c = 0; c < file->channels; c++) {
+        switch (file->format) {
+            case BLOOP_SAMPLE_S16:
+                s += (int16_t) bloop_sample_u16(p) / 32768.0f;
+                p += 2;
+                break;
+            case BLOOP_SAMPLE_S24:
+                s += ((int32_t)(p[0] << 8 | p[1] << 16 | (uint32_t)p[2] << 24) >> 8) / 8388608.0f;
+                p += 3;
+                break;
+            case BLOOP_SAMPLE_F32: {
+                uint32_t u = bloop_sample_u32(p);
+                float f;
+                memcpy(&f, &u, sizeof(f));
+                s += f;
+                p += 4;
+                break;
+            }
+        }
+    }
+    return s / file->channels;
+}
+
+float bloop_sample_frame(const bloop_sample_file *file, int64_t frame) {
+    return bloop_sample_read(file, frame);
+}
+
+// Plays the sample at the current position and moves on by speed.
+static inline float bloop_sample_next(bloop_sample_data *data, float speed) {
+    int64_t frame = (int64_t) floor(data->position);
+    float fraction = (float)(data->position - frame);
+    float a = bloop_sample_read(data->file, frame);
+    float b = bloop_sample_read(data->file, frame + 1);
+    data->position += (double) speed * data->file->rate / SAMPLE_RATE;
+    return a + fraction * (b - a);
+}
+
+static void bloop_sample_seek(bloop_sample_data *data, bloop_tick tick) {
+    if (tick <= data->last_tick) {
+        data->position = 0.0;
+    }
+    data->last_tick = tick;
+}
+
+float bloop_sample_(bloop_generator *g, void *value, bloop_tick tick) {
+    bloop_sample_data *data = (bloop_sample_data *) value;
+    float speed = bloop_run_input(g, BLOOP_SAMPLE_SPEED, tick);
+    float gain = bloop_run_input(g, BLOOP_SAMPLE_GAIN, tick);
+    bloop_sample_seek(data, tick);
+    float result = bloop_sample_next(data, speed) * gain;
+    atomic_store_explicit(&data->playing, (long long) data->position, memory_order_relaxed);
+    return result;
+}
+
+void bloop_sample_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_sample_data *data = (bloop_sample_data *) value;
+    float *speed = inputs[BLOOP_SAMPLE_SPEED];
+    float *gain = inputs[BLOOP_SAMPLE_GAIN];
+    bloop_sample_seek(data, tick);
+    for (int i = 0; i < n; i++) {
+        out[i] = bloop_sample_next(data, speed[i]) * gain[i];
+    }
+    data->last_tick = tick + n - 1;
+    atomic_store_explicit(&data->playing, (long long) data->position, memory_order_relaxed);
+}
+
+void bloop_sample_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_sample_data *data = (bloop_sample_data *) value;
+    float *gain = inputs[BLOOP_SAMPLE_GAIN];
+    double step = (double) inputs[BLOOP_SAMPLE_SPEED][0] * data->file->rate / SAMPLE_RATE;
+    bloop_sample_seek(data, tick);
+    if (step == 1.0 && data->position == floor(data->position)) {
+        // Playing every frame of the file as is.
+        int64_t frame = (int64_t) data->position;
+        for (int i = 0; i < n; i++) {
+            out[i] = bloop_sample_read(data->file, frame + i) * gain[i];
+        }
+        data->position += n;
+    } else {
+        for (int i = 0; i < n; i++) {
+            int64_t frame = (int64_t) floor(data->position);
+            float fraction = (float)(data->position - frame);
+            float a = bloop_sample_read(data->file, frame);
+            float b = bloop_sample_read(data->file, frame + 1);
+            out[i] = (a + fraction * (b - a)) * gain[i];
+            data->position += step;
+        }
+    }
+    data->last_tick = tick + n - 1;
+    atomic_store_explicit(&data->playing, (long long) data->position, memory_order_relaxed);
+}
+
+
+
+// The players the prefetch thread looks after. Only touched with the lock
+// held; the audio thread never takes it.
+static struct {
+    bloop_sample_data **players;
+    int count;
+    int capacity;
+    atomic_int running;
+#ifndef BLOOP_NO_THREADS
+    pthread_mutex_t lock;
+    pthread_t thread;
+#endif
+} bloop_prefetch = {
+#ifndef BLOOP_NO_THREADS
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+static void bloop_prefetch_lock(void) {
+#ifndef BLOOP_NO_THREADS
+    pthread_mutex_lock(&bloop_prefetch.lock);
+#endif
+}
+
+static void bloop_prefetch_unlock(void) {
+#ifndef BLOOP_NO_THREADS
+    pthread_mutex_unlock(&bloop_prefetch.lock);
+#endif
+}
+
+// Takes a player off the prefetch thread. The thread prefetches with the
+// lock held, so once this returns it's done with data.
+static void bloop_sample_release(void *data) {
+    bloop_prefetch_lock();
+    for (int i = 0; i < bloop_prefetch.count; i++) {
+        if (bloop_prefetch.players[i] == data) {
+            bloop_prefetch.players[i] = bloop_prefetch.players[--bloop_prefetch.count];
+            break;
+        }
+    }
+    bloop_prefetch_unlock();
+}
+
+// Takes every player of file off the prefetch thread.
+static void bloop_sample_forget(bloop_sample_file *file) {
+    bloop_prefetch_lock();
+    for (int i = 0; i < bloop_prefetch.count;) {
+        if (bloop_prefetch.players[i]->file == file) {
+            bloop_prefetch.players[i] = bloop_prefetch.players[--bloop_prefetch.count];
+        } else {
+            i++;
+        }
+    }
+    bloop_prefetch_unlock();
+}
+
+bloop_generator *bloop_sample(bloop_sample_file *file, bloop_generator *speed, bloop_generator *gain) {
+    bloop_sample_data *v = bloop_alloc(sizeof(*v));
+    v->file = file;
+    v->position = 0.0;
+    v->last_tick = -1;
+    atomic_init(&v->playing, 0);
+    v->prefetched = 0;
+    bloop_generator *g = bloop_new_generator(bloop_sample_, BLOOP_SAMPLE, "SAMPLE", v);
+    g->block_fn = bloop_sample_block_;
+    bloop_set_input_count(g, 2);
+    bloop_set_generator_input(BLOOP_SAMPLE_SPEED, g, speed, "speed");
+    bloop_set_generator_input(BLOOP_SAMPLE_GAIN, g, gain, "gain");
+
+    bloop_prefetch_lock();
+    if (bloop_prefetch.count == bloop_prefetch.capacity) {
+        bloop_prefetch.capacity = bloop_prefetch.capacity == 0 ? 16 : bloop_prefetch.capacity * 2;
+        bloop_prefetch.players = realloc(bloop_prefetch.players, sizeof(bloop_sample_data *) * bloop_prefetch.capacity);
+    }
+    bloop_prefetch.players[bloop_prefetch.count++] = v;
+    bloop_prefetch_unlock();
+    bloop_on_free(bloop_sample_release, v);
+    return g;
+}
+
+void bloop_sample_free(bloop_generator *g) {
+    bloop_sample_release(g->userData);
+}
+
+#ifdef BLOOP_NO_THREADS
+
+int bloop_sample_prefetch_start(void) {
+    return 0;
+}
+
+void bloop_sample_prefetch_stop(void) {
+}
+
+#else
+
+// Reads the pages from the frame being played up to
+// BLOOP_SAMPLE_PREFETCH_FRAMES ahead of it, skipping what was read before.
+static void bloop_sample_prefetch(bloop_sample_data *data, long page_size) {
+    const bloop_sample_file *file = data->file;
+    int64_t playing = atomic_load_explicit(&data->playing, memory_order_relaxed);
+    if (playing < data->prefetched - BLOOP_SAMPLE_PREFETCH_FRAMES || playing > data->prefetched) {
+        // Started again, or skipped ahead.
+        data->prefetched = playing < 0 ? 0 : playing;
+    }
+    int64_t end = playing + BLOOP_SAMPLE_PREFETCH_FRAMES;
+    if (end > file->frames) {
+        end = file->frames;
+    }
+    if (data->prefetched >= end) {
+        return;
+    }
+    const uint8_t *from = file->samples + data->prefetched * file->frame_size;
+    const uint8_t *to = file->samples + end * file->frame_size;
+    const uint8_t *page = (const uint8_t *)((uintptr_t) from & ~(uintptr_t)(page_size - 1));
+    madvise((void *) page, to - page, MADV_WILLNEED);
+    volatile uint8_t sink = 0;
+    for (; page < to; page += page_size) {
+        sink += *page;
+    }
+    data->prefetched = end;
+}
+
+static void *bloop_sample_prefetch_thread(void *arg) {
+    long page_size = sysconf(_SC_PAGESIZE);
+    while (atomic_load(&bloop_prefetch.running)) {
+        bloop_prefetch_lock();
+        for (int i = 0; i < bloop_prefetch.count; i++) {
+            bloop_sample_prefetch(bloop_prefetch.players[i], page_size);
+        }
+        bloop_prefetch_unlock();
+        usleep(BLOOP_SAMPLE_PREFETCH_INTERVAL);
+    }
+    return NULL;
+}
+
+int bloop_sample_prefetch_start(void) {
+    if (atomic_load(&bloop_prefetch.running)) {
+        return 1;
+    }
+    atomic_store(&bloop_prefetch.running, 1);
+    if (pthread_create(&bloop_prefetch.thread, NULL, bloop_sample_prefetch_thread, NULL) != 0) {
+        atomic_store(&bloop_prefetch.running, 0);
+        return 0;
+    }
+    return 1;
+}
+
+void bloop_sample_prefetch_stop(void) {
+    if (!atomic_load(&bloop_prefetch.running)) {
+        return;
+    }
+    atomic_store(&bloop_prefetch.running, 0);
+    pthread_join(bloop_prefetch.thread, NULL);
+}
+
+#endif
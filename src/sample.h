@@ -0,0 +1,95 @@
+#ifndef BLOOP_SAMPLE_H
+#define BLOOP_SAMPLE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "bloop.h"
+
+/*
+ * Sample players play recorded audio from WAV or raw PCM files, e.g.
+ *
+ *     bloop_sample_file *kick = bloop_sample_open("kick.wav");
+ *     bloop_generator *g = bloop_sample(kick, C(1.0), C(0.8));
+ *
+ * Files are mapped into memory instead of read, so a library of any size
+ * can be opened and only the parts that are played are ever loaded. The
+ * start of every file is requested from disk when it is opened; after that
+ * the prefetch thread (see bloop_sample_prefetch_start) reads the pages
+ * ahead of every playing sample, so the audio thread finds them in memory.
+ *
+ * Files with more than one channel are mixed down to mono. The speed input
+ * scales the playback rate: 1.0 plays at the original pitch (whatever the
+ * sample rate of the file), 2.0 an octave higher. Samples in between frames
+ * are interpolated.
+ *
+ * A sample starts playing at tick 0 and plays once. It starts again when it
+ * is played at an earlier tick than the last one, e.g. as the input of a
+ * repeat or sequence.
+ */
+
+// How far ahead of a playing sample the prefetch thread reads, and how much
+// of every file is requested when it is opened.
+#define BLOOP_SAMPLE_PREFETCH_FRAMES 65536
+// How often the prefetch thread checks the playing samples, in microseconds.
+#define BLOOP_SAMPLE_PREFETCH_INTERVAL 2000
+
+#define BLOOP_SAMPLE_SPEED 0
+#define BLOOP_SAMPLE_GAIN 1
+
+enum bloop_sample_format {
+    BLOOP_SAMPLE_S16,
+    BLOOP_SAMPLE_S24,
+    BLOOP_SAMPLE_F32,
+};
+
+typedef struct bloop_sample_file {
+    void *data;
+    size_t size;
+
+    // Frames of little endian, interleaved samples.
+    const uint8_t *samples;
+    int64_t frames;
+    enum bloop_sample_format format;
+    int channels;
+    int rate;
+    int frame_size;
+} bloop_sample_file;
+
+typedef struct bloop_sample_data {
+    bloop_sample_file *file;
+    double position;
+    bloop_tick last_tick;
+
+    // The frame being played, for the prefetch thread. Only the prefetch
+    // thread touches prefetched.
+    atomic_llong playing;
+    int64_t prefetched;
+} bloop_sample_data;
+
+// Returns NULL if the file can't be read or isn't a 16 bit, 24 bit or float
+// WAV file.
+bloop_sample_file *bloop_sample_open(const char *path);
+// Opens headerless PCM; NULL for an unknown format, like bloop_sample_open.
+bloop_sample_file *bloop_sample_open_raw(const char *path, enum bloop_sample_format format, int channels, int rate);
+// The file has to outlive the generators playing it. Closing it stops
+// prefetching for them.
+void bloop_sample_close(bloop_sample_file *file);
+// A frame of the file mixed down to mono, or silence outside the file.
+float bloop_sample_frame(const bloop_sample_file *file, int64_t frame);
+
+float bloop_sample_(bloop_generator *g, void *value, bloop_tick tick);
+void bloop_sample_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_sample_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+
+bloop_generator *bloop_sample(bloop_sample_file *file, bloop_generator *speed, bloop_generator *gain);
+// Stops prefetching for g; the generator belongs to the arena it was built in,
+// and freeing that arena stops it as well.
+void bloop_sample_free(bloop_generator *g);
+
+// Starts and stops the prefetch thread. Without it, playing a sample can
+// wait for the disk.
+int bloop_sample_prefetch_start(void);
+void bloop_sample_prefetch_stop(void);
+
+#endif
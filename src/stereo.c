@@ -0,0 +1,191 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stereo.h"
+#include "arena.h"
+#include "fastmath.h"
+
+// The gain of channel for a source at position.
+static inline float bloop_pan_gain(bloop_pan_data *data, float position) {
+    if (data->channels == 1) {
+        return 1.0;
+    }
+    position = fminf(fmaxf(position, -1.0f), 1.0f);
+    float distance = fabsf((position + 1.0f) * 0.5f * (data->channels - 1) - data->channel);
+    if (distance >= 1.0f) {
+        return 0.0;
+    }
+    // cos(distance * pi / 2), so the power over both channels adds up to 1.
+    return bloop_fast_sin((1.0f - distance) * (BLOOP_TWO_PI / 4.0f));
+}
+
+float bloop_pan_(bloop_generator *g, void *value, bloop_tick tick) {
+    bloop_pan_data *data = (bloop_pan_data *) value;
+    float s = bloop_run_input(g, BLOOP_PAN_INPUT, tick);
+    return s * bloop_pan_gain(data, bloop_run_input(g, BLOOP_PAN_POSITION, tick));
+}
+
+void bloop_pan_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_pan_data *data = (bloop_pan_data *) value;
+    float *input = inputs[BLOOP_PAN_INPUT];
+    float *position = inputs[BLOOP_PAN_POSITION];
+    for (int i = 0; i < n; i++) {
+        out[i] = input[i] * bloop_pan_gain(data, position[i]);
+    }
+}
+
+void bloop_pan_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_pan_data *data = (bloop_pan_data *) value;
+    float *input = inputs[BLOOP_PAN_INPUT];
+    float gain = bloop_pan_gain(data, inputs[BLOOP_PAN_POSITION][0]);
+    for (int i = 0; i < n; i++) {
+        out[i] = input[i] * gain;
+    }
+}
+
+bloop_generator *bloop_pan_channel(bloop_generator *input, bloop_generator *position, int channel, int channels) {
+    bloop_pan_data *v = bloop_alloc(sizeof(*v));
+    v->channel = channel;
+    v->channels = channels;
+    bloop_generator *g = bloop_new_generator(bloop_pan_, BLOOP_PAN, "PAN", v);
+    g->block_fn = bloop_pan_block_;
+    bloop_set_input_count(g, 2);
+    bloop_set_generator_input(BLOOP_PAN_INPUT, g, input, "input");
+    bloop_set_generator_input(BLOOP_PAN_POSITION, g, position, "position");
+    return g;
+}
+
+bloop_stereo bloop_pan(bloop_generator *input, bloop_generator *position) {
+    return (bloop_stereo) {
+        bloop_pan_channel(input, position, 0, 2),
+        bloop_pan_channel(input, position, 1, 2),
+    };
+}
+
+bloop_stereo bloop_spread(int count, bloop_generator **inputs, float width) {
+    bloop_stereo *panned = malloc(sizeof(bloop_stereo) * count);
+    for (int i = 0; i < count; i++) {
+        float position = count == 1 ? 0.0 : width * (2.0f * i / (count - 1) - 1.0f);
+        panned[i] = bloop_pan(inputs[i], bloop_constant(position));
+    }
+    bloop_stereo result = bloop_stereo_mix(count, panned);
+    free(panned);
+    return result;
+}
+
+bloop_stereo bloop_stereo_mix(int count, bloop_stereo *inputs) {
+    bloop_generator **channel = malloc(sizeof(bloop_generator *) * count);
+    bloop_stereo result;
+    for (int i = 0; i < count; i++) {
+        channel[i] = inputs[i].left;
+    }
+    result.left = bloop_average_array(count, channel);
+    for (int i = 0; i < count; i++) {
+        channel[i] = inputs[i].right;
+    }
+    result.right = bloop_average_array(count, channel);
+    free(channel);
+    return result;
+}
+
+
+
+// The source is an input of the tap, so it has always been rendered (and
+// has filled its outputs) by the time the tap runs.
+float bloop_tap_(bloop_generator *g, void *value, bloop_tick tick) {
+    bloop_tap_data *data = (bloop_tap_data *) value;
+    bloop_run_input(g, BLOOP_TAP_SOURCE, tick);
+    bloop_outputs *outputs = (bloop_outputs *) g->inputs[BLOOP_TAP_SOURCE]->userData;
+    return outputs->values[data->output];
+}
+
+void bloop_tap_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_tap_data *data = (bloop_tap_data *) value;
+    bloop_outputs *outputs = (bloop_outputs *) g->inputs[BLOOP_TAP_SOURCE]->userData;
+    memcpy(out, outputs->blocks[data->output], sizeof(float) * n);
+}
+
+bloop_generator *bloop_tap(bloop_generator *source, int output) {
+    bloop_tap_data *v = bloop_alloc(sizeof(*v));
+    v->output = output;
+    bloop_generator *g = bloop_new_generator(bloop_tap_, BLOOP_TAP, "TAP", v);
+    g->block_fn = bloop_tap_block_;
+    bloop_set_input_count(g, 1);
+    bloop_set_generator_input(BLOOP_TAP_SOURCE, g, source, "source");
+    return g;
+}
+
+
+
+#define bloop_stereo_delay_clamp(data, delay) (fminf(fmaxf((delay), 1.0f), (float)(data)->max_delay))
+
+static inline float bloop_stereo_delay_read(float *ring, int mask, int index, float delay) {
+    int whole = (int)delay;
+    float fraction = delay - whole;
+    float a = ring[(index - whole) & mask];
+    float b = ring[(index - whole - 1) & mask];
+    return a + fraction * (b - a);
+}
+
+// Renders one frame into left and right.
+static inline void bloop_stereo_delay_frame(bloop_stereo_delay_data *data, float in_left, float in_right, float samples, float factor, float feedback, float cross, float *left, float *right) {
+    float delay = bloop_stereo_delay_clamp(data, samples);
+    float l = in_left + bloop_stereo_delay_read(data->rings[0], data->mask, data->ring_index, delay) * factor;
+    float r = in_right + bloop_stereo_delay_read(data->rings[1], data->mask, data->ring_index, delay) * factor;
+    data->rings[0][data->ring_index] = in_left + feedback * (l + cross * (r - l));
+    data->rings[1][data->ring_index] = in_right + feedback * (r + cross * (l - r));
+    data->ring_index = (data->ring_index + 1) & data->mask;
+    *left = l;
+    *right = r;
+}
+
+float bloop_stereo_delay_(bloop_generator *g, void *value, bloop_tick tick) {
+    bloop_stereo_delay_data *data = (bloop_stereo_delay_data *) value;
+    bloop_stereo_delay_frame(data,
+            bloop_run_input(g, BLOOP_STEREO_DELAY_LEFT, tick),
+            bloop_run_input(g, BLOOP_STEREO_DELAY_RIGHT, tick),
+            bloop_run_input(g, BLOOP_STEREO_DELAY_SAMPLES, tick),
+            bloop_run_input(g, BLOOP_STEREO_DELAY_FACTOR, tick),
+            bloop_run_input(g, BLOOP_STEREO_DELAY_FEEDBACK, tick),
+            bloop_run_input(g, BLOOP_STEREO_DELAY_CROSS, tick),
+            &data->outputs.values[0], &data->outputs.values[1]);
+    return data->outputs.values[0];
+}
+
+void bloop_stereo_delay_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_stereo_delay_data *data = (bloop_stereo_delay_data *) value;
+    float *left = data->outputs.blocks[0];
+    float *right = data->outputs.blocks[1];
+    for (int i = 0; i < n; i++) {
+        bloop_stereo_delay_frame(data,
+                inputs[BLOOP_STEREO_DELAY_LEFT][i],
+                inputs[BLOOP_STEREO_DELAY_RIGHT][i],
+                inputs[BLOOP_STEREO_DELAY_SAMPLES][i],
+                inputs[BLOOP_STEREO_DELAY_FACTOR][i],
+                inputs[BLOOP_STEREO_DELAY_FEEDBACK][i],
+                inputs[BLOOP_STEREO_DELAY_CROSS][i],
+                &left[i], &right[i]);
+    }
+    memcpy(out, left, sizeof(float) * n);
+}
+
+bloop_stereo bloop_stereo_delay(bloop_stereo input, bloop_generator *delay_samples, bloop_generator *factor, bloop_generator *feedback, bloop_generator *cross, int max_delay_samples) {
+    bloop_stereo_delay_data *v = bloop_alloc(sizeof(*v));
+    int size = bloop_delay_ring_size(&max_delay_samples);
+    v->outputs.count = 2;
+    v->ring_index = 0;
+    v->mask = size - 1;
+    v->max_delay = max_delay_samples;
+    v->rings[0] = bloop_calloc(size, sizeof(float));
+    v->rings[1] = bloop_calloc(size, sizeof(float));
+    bloop_generator *g = bloop_new_generator(bloop_stereo_delay_, BLOOP_STEREO_DELAY, "STEREO DELAY", v);
+    g->block_fn = bloop_stereo_delay_block_;
+    bloop_set_input_count(g, 6);
+    bloop_set_generator_input(BLOOP_STEREO_DELAY_LEFT, g, input.left, "left");
+    bloop_set_generator_input(BLOOP_STEREO_DELAY_RIGHT, g, input.right, "right");
+    bloop_set_generator_input(BLOOP_STEREO_DELAY_SAMPLES, g, delay_samples, "samples");
+    bloop_set_generator_input(BLOOP_STEREO_DELAY_FACTOR, g, factor, "factor");
+    bloop_set_generator_input(BLOOP_STEREO_DELAY_FEEDBACK, g, feedback, "feedback");
+    bloop_set_generator_input(BLOOP_STEREO_DELAY_CROSS, g, cross, "cross");
+    return (bloop_stereo) { bloop_tap(g, 0), bloop_tap(g, 1) };
+}
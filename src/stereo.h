@@ -0,0 +1,98 @@
+#ifndef BLOOP_STEREO
+#define BLOOP_STEREO
+
+#include "bloop.h"
+
+/*
+ * Generators have a single output, so stereo (or any number of channels) is
+ * a generator for every channel, compiled into one plan with
+ * bloop_plan_compile_channels, e.g.
+ *
+ *     bloop_stereo s = bloop_pan(bloop_kick_drum_hit(), C(-0.5));
+ *     s = bloop_stereo_delay(s, C(11025), C(0.5), C(0.4), C(1.0), SAMPLE_RATE);
+ *     bloop_plan *plan = bloop_plan_compile_channels(2, (bloop_generator *[]) { s.left, s.right });
+ *
+ * Everything upstream of the pan is shared by both channels, so it is only
+ * rendered once.
+ *
+ * Generators that produce more than one channel at once (e.g. the stereo
+ * delay, whose channels feed back into each other) keep their channels in a
+ * bloop_outputs at the start of their data, and every channel is played by
+ * a tap generator. The taps are the consumers of the generator, so it is
+ * rendered once for all of them.
+ */
+
+typedef struct bloop_stereo {
+    bloop_generator *left;
+    bloop_generator *right;
+} bloop_stereo;
+
+#define BLOOP_MAX_OUTPUTS 2
+
+// The outputs of a generator, written by its block function (blocks) and by
+// its per-sample function (values). Channel 0 is also the output of the
+// generator itself.
+typedef struct bloop_outputs {
+    int count;
+    float blocks[BLOOP_MAX_OUTPUTS][BLOOP_MAX_BLOCK];
+    float values[BLOOP_MAX_OUTPUTS];
+} bloop_outputs;
+
+#define BLOOP_PAN_INPUT 0
+#define BLOOP_PAN_POSITION 1
+// The most channels a patch file can pan over.
+#define BLOOP_PAN_MAX_CHANNELS 64
+
+// Channels are spread evenly from position -1 to 1, and a source is heard
+// on the two channels nearest to it with equal power panning.
+typedef struct bloop_pan_data {
+    int channel;
+    int channels;
+} bloop_pan_data;
+
+#define BLOOP_TAP_SOURCE 0
+
+typedef struct bloop_tap_data {
+    int output;
+} bloop_tap_data;
+
+#define BLOOP_STEREO_DELAY_LEFT 0
+#define BLOOP_STEREO_DELAY_RIGHT 1
+#define BLOOP_STEREO_DELAY_SAMPLES 2
+#define BLOOP_STEREO_DELAY_FACTOR 3
+#define BLOOP_STEREO_DELAY_FEEDBACK 4
+#define BLOOP_STEREO_DELAY_CROSS 5
+
+// Two delay rings of the same length; see bloop_delay_data.
+typedef struct bloop_stereo_delay_data {
+    bloop_outputs outputs;
+    int ring_index;
+    int mask;
+    int max_delay;
+    float *rings[2];
+} bloop_stereo_delay_data;
+
+float bloop_pan_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_tap_(bloop_generator *g, void *value, bloop_tick tick);
+float bloop_stereo_delay_(bloop_generator *g, void *value, bloop_tick tick);
+
+void bloop_pan_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_pan_constant_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_tap_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+void bloop_stereo_delay_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+
+// Plays input on one of channels channels at position (-1 to 1).
+bloop_generator *bloop_pan_channel(bloop_generator *input, bloop_generator *position, int channel, int channels);
+bloop_stereo bloop_pan(bloop_generator *input, bloop_generator *position);
+// Pans count inputs evenly from -width to width and mixes them.
+bloop_stereo bloop_spread(int count, bloop_generator **inputs, float width);
+// Averages the left and right channels of count inputs.
+bloop_stereo bloop_stereo_mix(int count, bloop_stereo *inputs);
+// Plays an output of a generator with more than one output.
+bloop_generator *bloop_tap(bloop_generator *source, int output);
+// A delay per channel; cross (0 to 1) is how much of the feedback of each
+// channel goes to the other one, so 1 bounces between the channels.
+// max_delay_samples is clamped like that of bloop_delay.
+bloop_stereo bloop_stereo_delay(bloop_stereo input, bloop_generator *delay_samples, bloop_generator *factor, bloop_generator *feedback, bloop_generator *cross, int max_delay_samples);
+
+#endif
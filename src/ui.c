@@ -1,5 +1,6 @@
 #include "ui.h"
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
@@ -51,7 +52,7 @@ node_editor_find(struct node_editor *editor, int ID)
 
 static int
 node_editor_add(struct node_editor *editor, const char *name, struct nk_rect bounds,
-    struct nk_color col, int in_count, int out_count)
+    struct nk_color col, int in_count, int out_count, bloop_generator *generator)
 {
     static int IDs = 0;
     struct node *node;
@@ -63,6 +64,9 @@ node_editor_add(struct node_editor *editor, const char *name, struct nk_rect bou
     node->output_count = out_count;
     node->color = col;
     node->bounds = bounds;
+    node->generator = generator;
+    node->profile_time = generator != NULL ? atomic_load(&generator->profile_time) : 0;
+    node->load = 0;
     strcpy(node->name, name);
     node_editor_push(editor, node);
     return node->ID;
@@ -98,6 +102,41 @@ node_editor_init(struct node_editor *editor)
     editor->show_grid = nk_true;
 }
 
+// The load shown on a node card goes from green to red as it goes up to
+// this percentage of the budget.
+#define NODE_EDITOR_HOT_LOAD 5.0f
+#define NODE_EDITOR_PROFILE_INTERVAL 0.5
+
+// The audio thread has to render a second of audio every second, so the
+// time a generator took during the last interval, divided by the length of
+// the interval, is its share of the callback budget.
+static void
+node_editor_refresh_load(struct node_editor *editor)
+{
+    uint64_t elapsed = stm_since(editor->profile_refreshed);
+    if (stm_sec(elapsed) < NODE_EDITOR_PROFILE_INTERVAL) {
+        return;
+    }
+    editor->profile_refreshed = stm_now();
+    struct node *it = editor->begin;
+    while (it) {
+        if (it->generator != NULL) {
+            uint64_t total = atomic_load_explicit(&it->generator->profile_time, memory_order_relaxed);
+            it->load = (float)(100.0 * stm_sec(total - it->profile_time) / stm_sec(elapsed));
+            it->profile_time = total;
+        }
+        it = it->next;
+    }
+}
+
+static struct nk_color
+node_editor_heat(float load)
+{
+    float heat = load / NODE_EDITOR_HOT_LOAD;
+    heat = heat > 1.0f ? 1.0f : heat;
+    return nk_rgb((nk_byte)(255 * heat), (nk_byte)(255 * (1.0f - heat)), 0);
+}
+
 int
 node_editor(struct nk_context *ctx)
 {
@@ -112,6 +151,9 @@ node_editor(struct nk_context *ctx)
         node_editor_init(&nodeEditor);
         nodeEditor.initialized = 1;
     }
+    if (bloop_profile_enabled) {
+        node_editor_refresh_load(nodedit);
+    }
 
     if (nk_begin(ctx, "NodeEdit", nk_rect(0, 0, 1024, 800),
         NK_WINDOW_BORDER|NK_WINDOW_NO_SCROLLBAR|NK_WINDOW_MOVABLE|NK_WINDOW_CLOSABLE))
@@ -158,6 +200,20 @@ node_editor(struct nk_context *ctx)
 
                     /* ================= NODE CONTENT =====================*/
                     nk_layout_row_dynamic(ctx, 25, 1);
+                    if (it->generator != NULL && it->generator->type == BLOOP_PARAM) {
+                        bloop_param_data *param = (bloop_param_data *) it->generator->userData;
+                        float step = (param->max - param->min) / 100.0f;
+                        float value = bloop_param_get(it->generator);
+                        float updated_value = nk_propertyf(ctx, "#", param->min, value, param->max, step, step);
+                        if (updated_value != value) {
+                            bloop_param_set(it->generator, updated_value);
+                        }
+                    }
+                    if (it->generator != NULL && bloop_profile_enabled) {
+                        char load[16];
+                        snprintf(load, sizeof(load), "%.2f%%", it->load);
+                        nk_label_colored(ctx, load, NK_TEXT_LEFT, node_editor_heat(it->load));
+                    }
                     /*
                     nk_button_color(ctx, it->color);
                     it->color.r = (nk_byte)nk_propertyi(ctx, "#R:", 0, it->color.r, 255, 1,1);
@@ -277,7 +333,7 @@ node_editor(struct nk_context *ctx)
                 nk_layout_row_dynamic(ctx, 25, 1);
                 if (nk_contextual_item_label(ctx, "New", NK_TEXT_CENTERED))
                     node_editor_add(nodedit, "New", nk_rect(400, 260, 180, 220),
-                            nk_rgb(255, 255, 255), 1, 2);
+                            nk_rgb(255, 255, 255), 1, 2, NULL);
                 if (nk_contextual_item_label(ctx, grid_option[nodedit->show_grid],NK_TEXT_CENTERED))
                     nodedit->show_grid = !nodedit->show_grid;
                 nk_contextual_end(ctx);
@@ -296,9 +352,45 @@ node_editor(struct nk_context *ctx)
     return !nk_window_is_closed(ctx, "BLOOP");
 }
 
+void
+audio_stats(struct nk_context *ctx, bloop_callback_stats *stats)
+{
+    if (nk_begin(ctx, "Audio", nk_rect(1024, 0, 240, 420),
+        NK_WINDOW_BORDER|NK_WINDOW_MOVABLE|NK_WINDOW_MINIMIZABLE|NK_WINDOW_TITLE))
+    {
+        char text[64];
+        nk_layout_row_dynamic(ctx, 20, 1);
+        snprintf(text, sizeof(text), "load: %.1f%%", atomic_load(&stats->load));
+        nk_label(ctx, text, NK_TEXT_LEFT);
+        snprintf(text, sizeof(text), "worst: %.1f%% (%.2f ms)", atomic_load(&stats->worst_load),
+            stm_ms(atomic_load(&stats->worst_time)));
+        nk_label(ctx, text, NK_TEXT_LEFT);
+        snprintf(text, sizeof(text), "overruns: %llu of %llu", atomic_load(&stats->overruns),
+            atomic_load(&stats->callbacks));
+        nk_label(ctx, text, NK_TEXT_LEFT);
+
+        /* histogram of the callback loads */
+        unsigned long long counts[BLOOP_STATS_BUCKETS];
+        unsigned long long max = 1;
+        for (int i = 0; i < BLOOP_STATS_BUCKETS; i++) {
+            counts[i] = atomic_load(&stats->histogram[i]);
+            max = counts[i] > max ? counts[i] : max;
+        }
+        nk_layout_row_dynamic(ctx, 200, 1);
+        if (nk_chart_begin_colored(ctx, NK_CHART_COLUMN, node_editor_heat(0), node_editor_heat(NODE_EDITOR_HOT_LOAD),
+            BLOOP_STATS_BUCKETS, 0, (float)max)) {
+            for (int i = 0; i < BLOOP_STATS_BUCKETS; i++) {
+                nk_chart_push(ctx, (float)counts[i]);
+            }
+            nk_chart_end(ctx);
+        }
+    }
+    nk_end(ctx);
+}
+
 
 int add_node(struct node_editor *editor, bloop_generator *g, char *title, int inputs) {
-    return node_editor_add(editor, g->title, nk_rect(g->x * 180, g->y * 110, 100, 100), nk_rgb(255, 0, 0), inputs, 1);
+    return node_editor_add(editor, g->meta->title, nk_rect(g->meta->x * 180, g->meta->y * 110, 100, 100), nk_rgb(255, 0, 0), inputs, 1, g);
 }
 
 int bloop_generator_to_nodes_and_link(struct node_editor *editor, bloop_generator *g, int output_id, int output_slot) {
@@ -312,7 +404,7 @@ int bloop_generator_to_nodes(struct node_editor *editor, bloop_generator *g) {
     if (g == NULL) {
         return -1;
     }
-    int id = add_node(editor, g, g->title, g->input_count);
+    int id = add_node(editor, g, g->meta->title, g->input_count);
     for (int i = 0; i < g->input_count; i++) {
         if (g->inputs[i] != NULL) {
             bloop_generator_to_nodes_and_link(editor, g->inputs[i], id, i);
@@ -3,7 +3,9 @@
 #define NK_INCLUDE_FONT_BAKING
 #define NK_INCLUDE_DEFAULT_FONT
 #include "nuklear.h"
+#include <stdint.h>
 #include "bloop.h"
+#include "profile.h"
 
 struct node {
     int ID;
@@ -13,6 +15,11 @@ struct node {
     struct nk_color color;
     int input_count;
     int output_count;
+    bloop_generator *generator;
+    // The generator's profile time at the last refresh, and the share of
+    // the audio callback budget it used since the refresh before.
+    uint64_t profile_time;
+    float load;
     struct node *next;
     struct node *prev;
 };
@@ -46,6 +53,7 @@ struct node_editor {
     int show_grid;
     struct nk_vec2 scrolling;
     struct node_linking linking;
+    uint64_t profile_refreshed;
 };
 static struct node_editor nodeEditor;
 
@@ -58,5 +66,6 @@ typedef struct add_node_result {
 int bloop_generator_to_nodes_and_link(struct node_editor *editor, bloop_generator *g, int output_id, int output_slot);
 int bloop_generator_to_nodes(struct node_editor *editor, bloop_generator *g);
 int node_editor(struct nk_context *ctx);
+void audio_stats(struct nk_context *ctx, bloop_callback_stats *stats);
 
 extern bloop_generator *generator;
@@ -0,0 +1,180 @@
+#include <float.h>
+#include <math.h>
+#include <string.h>
+#include "voices.h"
+#include "arena.h"
+
+extern int SAMPLE_RATE;
+
+static int bloop_voices_peek(bloop_voices_data *data, bloop_note **note) {
+    unsigned int head = atomic_load_explicit(&data->head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(&data->tail, memory_order_acquire);
+    if (head == tail) {
+        return 0;
+    }
+    *note = &data->queue[head % BLOOP_VOICE_QUEUE_SIZE];
+    return 1;
+}
+
+static void bloop_voices_pop(bloop_voices_data *data) {
+    unsigned int head = atomic_load_explicit(&data->head, memory_order_relaxed);
+    atomic_store_explicit(&data->head, head + 1, memory_order_release);
+}
+
+// Picks a free voice, or steals the quietest (and then the oldest) one.
+static bloop_voice *bloop_voices_pick(bloop_voices_data *data) {
+    bloop_voice *result = &data->voices[0];
+    for (int i = 0; i < data->voice_count; i++) {
+        bloop_voice *v = &data->voices[i];
+        if (!v->active) {
+            return v;
+        }
+        if (v->level < result->level || (v->level == result->level && v->start < result->start)) {
+            result = v;
+        }
+    }
+    return result;
+}
+
+static void bloop_voices_start(bloop_voices_data *data, bloop_note *note, bloop_tick tick) {
+    bloop_voice *v = bloop_voices_pick(data);
+    bloop_param_set(v->pitch, note->pitch);
+    bloop_reset(v->root);
+    v->active = 1;
+    v->start = tick;
+    v->velocity = note->velocity;
+    // Voices that haven't been heard yet are the last ones to be stolen.
+    v->level = FLT_MAX;
+    v->silent = 0;
+}
+
+// Adds n ticks of every active voice to out.
+static void bloop_voices_mix(bloop_voices_data *data, float *out, int n, bloop_tick tick) {
+    for (int i = 0; i < data->voice_count; i++) {
+        bloop_voice *v = &data->voices[i];
+        if (!v->active) {
+            continue;
+        }
+        bloop_tick local = tick - v->start;
+        int len = n;
+        if (data->length > 0 && local + len > data->length) {
+            len = (int)(data->length - local);
+        }
+        bloop_plan_run(v->plan, data->buffer, len, local);
+        if (v->level == FLT_MAX) {
+            v->level = 0.0f;
+        }
+        // The level and silence are followed sample by sample and the voice
+        // stops on the exact tick it has been silent for long enough, so
+        // which voice gets stolen doesn't depend on the block size.
+        for (int j = 0; j < len; j++) {
+            float s = data->buffer[j] * v->velocity;
+            float a = fabsf(s);
+            out[j] += s;
+            v->level *= data->fall;
+            v->level = a > v->level ? a : v->level;
+            v->silent = a < BLOOP_VOICE_SILENCE ? v->silent + 1 : 0;
+            if (data->length == 0 && v->silent >= BLOOP_VOICE_RELEASE) {
+                v->active = 0;
+                break;
+            }
+        }
+        if (len < n) {
+            v->active = 0;
+        }
+    }
+}
+
+void bloop_voices_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick) {
+    bloop_voices_data *data = (bloop_voices_data *) value;
+    memset(out, 0, sizeof(float) * n);
+    // Notes start exactly on their tick, so the block is split wherever a
+    // note starts.
+    int done = 0;
+    while (done < n) {
+        int len = n - done;
+        bloop_note *note;
+        while (bloop_voices_peek(data, &note)) {
+            if (note->tick > tick + done) {
+                if (note->tick - (tick + done) < len) {
+                    len = (int)(note->tick - (tick + done));
+                }
+                break;
+            }
+            bloop_voices_start(data, note, tick + done);
+            bloop_voices_pop(data);
+        }
+        bloop_voices_mix(data, out + done, len, tick + done);
+        done += len;
+    }
+}
+
+float bloop_voices_(bloop_generator *g, void *value, bloop_tick tick) {
+    float out;
+    bloop_voices_block_(g, value, NULL, &out, 1, tick);
+    return out;
+}
+
+// Frees the plans of the voices, and what their generators hold outside of
+// the arena.
+static void bloop_voices_release(void *value) {
+    bloop_voices_data *data = (bloop_voices_data *) value;
+    for (int i = 0; i < data->voice_count; i++) {
+        if (data->voices[i].plan != NULL) {
+            bloop_plan_free(data->voices[i].plan);
+            data->voices[i].plan = NULL;
+            bloop_free_graph(data->voices[i].root);
+        }
+    }
+}
+
+bloop_generator *bloop_voices(int voice_count, int length, bloop_voice_template template) {
+    bloop_voices_data *v = bloop_alloc(sizeof(*v));
+    v->voice_count = voice_count;
+    v->length = length;
+    v->voices = bloop_alloc(sizeof(bloop_voice) * voice_count);
+    v->fall = (float) exp(-1.0 / (BLOOP_VOICE_FALL * SAMPLE_RATE));
+    atomic_init(&v->head, 0);
+    atomic_init(&v->tail, 0);
+    for (int i = 0; i < voice_count; i++) {
+        bloop_voice *voice = &v->voices[i];
+        voice->pitch = bloop_param(440.0, 0.0, SAMPLE_RATE / 2, 0);
+        voice->root = template(voice->pitch);
+        bloop_optimize(voice->root);
+        voice->plan = bloop_plan_compile(voice->root);
+        voice->active = 0;
+        voice->start = 0;
+        voice->velocity = 0.0;
+        voice->level = 0.0;
+        voice->silent = 0;
+    }
+    bloop_generator *g = bloop_new_generator(bloop_voices_, BLOOP_VOICES, "VOICES", v);
+    g->block_fn = bloop_voices_block_;
+    bloop_on_free(bloop_voices_release, v);
+    return g;
+}
+
+void bloop_voices_free(bloop_generator *g) {
+    bloop_voices_release(g->userData);
+}
+
+int bloop_voices_note_on(bloop_generator *g, bloop_tick tick, float pitch, float velocity) {
+    bloop_voices_data *data = (bloop_voices_data *) g->userData;
+    unsigned int tail = atomic_load_explicit(&data->tail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&data->head, memory_order_acquire);
+    if (tail - head == BLOOP_VOICE_QUEUE_SIZE) {
+        return 0;
+    }
+    data->queue[tail % BLOOP_VOICE_QUEUE_SIZE] = (bloop_note) { tick, pitch, velocity };
+    atomic_store_explicit(&data->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+int bloop_voices_active(bloop_generator *g) {
+    bloop_voices_data *data = (bloop_voices_data *) g->userData;
+    int result = 0;
+    for (int i = 0; i < data->voice_count; i++) {
+        result += data->voices[i].active;
+    }
+    return result;
+}
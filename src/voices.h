@@ -0,0 +1,94 @@
+#ifndef BLOOP_VOICES_H
+#define BLOOP_VOICES_H
+
+#include <stdatomic.h>
+#include "bloop.h"
+#include "plan.h"
+
+/*
+ * A voice pool plays notes on a fixed number of voices, which are all built
+ * up front from the same template, e.g.
+ *
+ *     bloop_generator *pad(bloop_generator *pitch) {
+ *         return bloop_sine_wave(pitch, bloop_adsr(1.0, 0.3, 200, 2000, 6000, 8000));
+ *     }
+ *
+ *     bloop_generator *voices = bloop_voices(8, 0, pad);
+ *     bloop_voices_note_on(voices, 44100, 440.0, 0.8);
+ *
+ * The template gets a parameter for the pitch of the note; the output of a
+ * voice is scaled by the velocity of its note. Every voice has a plan of its
+ * own and is played with ticks counting from the start of its note.
+ *
+ * Notes are handed to the audio thread through a lock-free queue, so one
+ * other thread (e.g. a sequencer or the UI) can call bloop_voices_note_on
+ * while the pool is playing. When a note starts, a free voice is reset and
+ * reused; if all voices are busy the quietest one is stolen, or the oldest of
+ * the quietest ones. How quiet a voice is comes from a peak follower on its
+ * output that falls by 1/e every BLOOP_VOICE_FALL seconds, so it doesn't
+ * depend on the block size. A voice is free again after length ticks, or when
+ * length is 0, once it has been silent for BLOOP_VOICE_RELEASE ticks. None
+ * of this allocates.
+ *
+ * The pool has to be played at increasing ticks, so it shouldn't be used as
+ * the input of a repeat, offset or sequence.
+ */
+
+#define BLOOP_VOICE_QUEUE_SIZE 256
+#define BLOOP_VOICE_SILENCE 1e-4f
+#define BLOOP_VOICE_RELEASE 1024
+#define BLOOP_VOICE_FALL 0.05
+
+typedef bloop_generator *(*bloop_voice_template)(bloop_generator *pitch);
+
+typedef struct bloop_voice {
+    bloop_generator *root;
+    bloop_generator *pitch;
+    bloop_plan *plan;
+    int active;
+    bloop_tick start;
+    float velocity;
+    // The followed peak level, used to pick a voice to steal.
+    float level;
+    int silent;
+} bloop_voice;
+
+typedef struct bloop_note {
+    bloop_tick tick;
+    float pitch;
+    float velocity;
+} bloop_note;
+
+typedef struct bloop_voices_data {
+    int voice_count;
+    bloop_voice *voices;
+    int length;
+    // What the level of a voice is multiplied by every tick.
+    float fall;
+
+    // Written by bloop_voices_note_on, read by the audio thread.
+    bloop_note queue[BLOOP_VOICE_QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+
+    float buffer[BLOOP_MAX_BLOCK];
+} bloop_voices_data;
+
+float bloop_voices_(bloop_generator *g, void *value, bloop_tick tick);
+void bloop_voices_block_(bloop_generator *g, void *value, float **inputs, float *out, int n, bloop_tick tick);
+
+bloop_generator *bloop_voices(int voice_count, int length, bloop_voice_template template);
+// Frees the plans of the voices, once however often it is called; the
+// generators belong to the arena they were built in, and freeing that arena
+// frees the plans as well.
+void bloop_voices_free(bloop_generator *g);
+
+// Queues a note that starts at tick, or as soon as possible if tick has
+// already been played. Notes should be queued in the order they start in.
+// Returns 0 if the queue is full.
+int bloop_voices_note_on(bloop_generator *g, bloop_tick tick, float pitch, float velocity);
+
+// The number of voices that are playing; only meaningful on the audio thread.
+int bloop_voices_active(bloop_generator *g);
+
+#endif
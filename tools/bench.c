@@ -0,0 +1,234 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "sokol_time.h"
+#include "bloop.h"
+#include "patches.h"
+#include "plan.h"
+#include "arena.h"
+#include "voices.h"
+#include "sample.h"
+#include "stereo.h"
+#include "oversample.h"
+#include "filter.h"
+#include "convolution.h"
+#include "fdn.h"
+
+/*
+ * Benchmarks for the engine, timed with sokol_time.h:
+ *
+ * - generators: every bloop_generator_type in isolation with constant inputs
+ *   (or white noise, where a constant would be a special case), compiled
+ *   into a plan without bloop_optimize so the generic kernels are measured,
+ *   and once more optimized.
+ * - patches: every patch from patches.c, optimized and compiled.
+ * - engines: every patch rendered with bloop_run, bloop_render and a plan,
+ *   checking that bloop_render and plans with callbacks of
+ *   BENCH_CALLBACK_FRAMES and BENCH_SMALL_FRAMES produce exactly the same
+ *   samples as bloop_run.
+ *
+ * Timings are reported in ns per sample and as a realtime factor (how many
+ * seconds of audio are rendered per second) for several callback sizes.
+ */
+
+#define BENCH_SECONDS 10
+#define BENCH_CALLBACK_FRAMES 2048
+#define BENCH_SMALL_FRAMES 64
+
+extern int SAMPLE_RATE;
+
+static int block_sizes[] = { 64, 256, 2048 };
+#define BENCH_BLOCK_SIZES (sizeof(block_sizes) / sizeof(block_sizes[0]))
+
+enum bench_mode {
+    BENCH_RUN,
+    BENCH_RENDER,
+    BENCH_PLAN,
+};
+
+static bloop_generator *bench_sine() { return bloop_sine_wave(C(440.0), C(1.0)); }
+static bloop_generator *bench_white_noise() { return bloop_white_noise(C(1.0)); }
+static bloop_generator *bench_interpolation() { return bloop_interpolation(0.0, 1.0, BENCH_SECONDS * SAMPLE_RATE); }
+static bloop_generator *bench_constant() { return C(1.0); }
+static bloop_generator *bench_adsr() { return bloop_adsr(1.0, 0.5, SAMPLE_RATE, SAMPLE_RATE, 6 * SAMPLE_RATE, SAMPLE_RATE); }
+static bloop_generator *bench_lfo() { return LFO(2.0, 0.0, 1.0); }
+static bloop_generator *bench_distortion() { return bloop_distortion(C(0.9), C(0.5), C(2.0)); }
+static bloop_generator *bench_delay() { return bloop_delay(C(0.5), C(11025), C(0.5), C(0.2), 11025); }
+static bloop_generator *bench_repeat() { return bloop_repeat(C(1.0), 1000); }
+static bloop_generator *bench_offset() { return bloop_offset(C(1.0), 1000); }
+static bloop_generator *bench_average() { return bloop_average(4, C(0.1), C(0.2), C(0.3), C(0.4)); }
+static bloop_generator *bench_sequence() {
+    int step = BENCH_SECONDS * SAMPLE_RATE / 4;
+    return bloop_sequence(4, C(0.1), step, C(0.2), step, C(0.3), step, C(0.4), step);
+}
+static bloop_generator *bench_param() { return bloop_param(0.5, 0.0, 1.0, 441); }
+static bloop_generator *bench_voice(bloop_generator *pitch) { return bloop_sine_wave(pitch, bloop_adsr(1.0, 0.3, 200, 2000, 6000, 8000)); }
+static bloop_generator *bench_voices() {
+    bloop_generator *g = bloop_voices(8, 0, bench_voice);
+    for (int i = 0; i < BLOOP_VOICE_QUEUE_SIZE; i++) {
+        bloop_voices_note_on(g, i * 2205, 220.0 + 20.0 * (i % 8), 0.5);
+    }
+    return g;
+}
+// Noise as raw PCM, as long as a render, written by main.
+static bloop_sample_file *bench_sample_file;
+static bloop_generator *bench_sample() { return bloop_sample(bench_sample_file, C(1.0), C(1.0)); }
+static bloop_generator *bench_pan() { return bloop_pan_channel(C(1.0), C(0.3), 0, 2); }
+static bloop_generator *bench_stereo_delay() {
+    return bloop_stereo_delay(bloop_pan(bloop_white_noise(C(1.0)), C(0.3)), C(11025), C(0.5), C(0.2), C(0.5), 11025).left;
+}
+static bloop_generator *bench_oversample() { return bloop_oversample(bloop_distortion(bloop_white_noise(C(1.0)), C(0.5), C(2.0)), 4); }
+static bloop_generator *bench_biquad() { return bloop_biquad(bloop_white_noise(C(1.0)), C(1000.0), C(0.7), BLOOP_LOWPASS, 1); }
+static bloop_generator *bench_svf() { return bloop_svf(bloop_white_noise(C(1.0)), C(1000.0), C(0.7), BLOOP_LOWPASS, 1); }
+static bloop_generator *bench_convolution() {
+    float *ir = malloc(sizeof(float) * SAMPLE_RATE);
+    for (int i = 0; i < SAMPLE_RATE; i++) {
+        ir[i] = bloop_sample_frame(bench_sample_file, i) * 0.01f;
+    }
+    bloop_generator *g = bloop_convolution(bloop_white_noise(C(1.0)), ir, SAMPLE_RATE, C(0.3));
+    free(ir);
+    return g;
+}
+static bloop_generator *bench_fdn() { return bloop_fdn(bloop_white_noise(C(1.0)), C(2.0), C(5000.0), C(0.3), 8, 1.0f); }
+
+// In the same order as enum bloop_generator_type. The stereo delay is
+// measured through its left tap, so it is the row of BLOOP_TAP.
+static bloop_generator *(*generators[])() = {
+    bench_sine,
+    bench_white_noise,
+    bench_interpolation,
+    bench_constant,
+    bench_adsr,
+    bench_lfo,
+    bench_distortion,
+    bench_delay,
+    bench_repeat,
+    bench_offset,
+    bench_average,
+    bench_sequence,
+    bench_param,
+    bench_voices,
+    bench_sample,
+    bench_pan,
+    bench_stereo_delay,
+    bench_oversample,
+    bench_biquad,
+    bench_svf,
+    bench_convolution,
+    bench_fdn,
+};
+
+// Renders frames samples of a freshly built generator, block frames per call,
+// and returns the time it took in ns per sample.
+static double bench_render(bloop_generator *(*build)(), enum bench_mode mode, int optimize, float *out, int frames, int block) {
+    bloop_arena *arena = bloop_arena_new(BLOOP_ARENA_CHUNK_SIZE);
+    bloop_arena_use(arena);
+    bloop_random_seed_global(0);
+    bloop_generator *g = build();
+    bloop_plan *plan = NULL;
+    if (optimize) {
+        bloop_optimize(g);
+    }
+    bloop_arena_use(NULL);
+    if (mode == BENCH_PLAN) {
+        plan = bloop_plan_compile(g);
+    }
+    uint64_t start = stm_now();
+    for (bloop_tick tick = 0; tick < frames; tick += block) {
+        int n = frames - tick < block ? frames - tick : block;
+        switch (mode) {
+            case BENCH_RUN:
+                for (int i = 0; i < n; i++) {
+                    out[tick + i] = bloop_run(g, tick + i);
+                }
+                break;
+            case BENCH_RENDER:
+                bloop_render(g, out + tick, n, tick);
+                break;
+            case BENCH_PLAN:
+                bloop_plan_run(plan, out + tick, n, tick);
+                break;
+        }
+    }
+    double ns = stm_ns(stm_since(start));
+    if (plan != NULL) {
+        bloop_plan_free(plan);
+    }
+    bloop_free_graph(g);
+    bloop_arena_free(arena);
+    return ns / frames;
+}
+
+static double realtime_factor(double ns_per_sample) {
+    return (1e9 / SAMPLE_RATE) / ns_per_sample;
+}
+
+static void print_header(char *title, char *extra) {
+    printf("\n%-26s", title);
+    for (int i = 0; i < BENCH_BLOCK_SIZES; i++) {
+        printf("  block=%-4d ns/smp realtime", block_sizes[i]);
+    }
+    printf("%s\n", extra);
+}
+
+static void print_block_sizes(bloop_generator *(*build)(), int optimize, float *out, int frames) {
+    for (int i = 0; i < BENCH_BLOCK_SIZES; i++) {
+        double ns = bench_render(build, BENCH_PLAN, optimize, out, frames, block_sizes[i]);
+        printf("  %17.2f %7.0fx", ns, realtime_factor(ns));
+    }
+}
+
+int main(int argc, char **argv) {
+    stm_setup();
+    int frames = BENCH_SECONDS * SAMPLE_RATE;
+    float *run = malloc(sizeof(float) * frames);
+    float *render = malloc(sizeof(float) * frames);
+    float *plan = malloc(sizeof(float) * frames);
+    float *small = malloc(sizeof(float) * frames);
+
+    char sample_path[64];
+    snprintf(sample_path, sizeof(sample_path), "/tmp/bloop_bench_%d.raw", (int) getpid());
+    FILE *sample = fopen(sample_path, "wb");
+    for (int i = 0; i < BENCH_SECONDS * SAMPLE_RATE; i++) {
+        float s = (float) rand() / RAND_MAX * 2.0f - 1.0f;
+        fwrite(&s, sizeof(s), 1, sample);
+    }
+    fclose(sample);
+    bench_sample_file = bloop_sample_open_raw(sample_path, BLOOP_SAMPLE_F32, 1, SAMPLE_RATE);
+    unlink(sample_path);
+
+    print_header("generators", "  optimized ns/smp");
+    for (int i = 0; i < sizeof(generators) / sizeof(generators[0]); i++) {
+        bloop_arena *arena = bloop_arena_new(BLOOP_ARENA_CHUNK_SIZE);
+        bloop_arena_use(arena);
+        bloop_generator *g = generators[i]();
+        printf("%-26s", g->meta->title);
+        bloop_free_graph(g);
+        bloop_arena_free(arena);
+        print_block_sizes(generators[i], 0, plan, frames);
+        printf("  %16.2f\n", bench_render(generators[i], BENCH_PLAN, 1, plan, frames, BENCH_CALLBACK_FRAMES));
+    }
+
+    print_header("patches", "");
+    for (int i = 0; i < bloop_patch_count; i++) {
+        printf("%-26s", bloop_patches[i].name);
+        print_block_sizes(bloop_patches[i].build, 1, plan, frames);
+        printf("\n");
+    }
+
+    printf("\n%-26s %14s %14s %14s %9s %10s\n", "engines", "run ns/smp", "render ns/smp", "plan ns/smp", "speedup", "identical");
+    for (int i = 0; i < bloop_patch_count; i++) {
+        bloop_generator *(*build)() = bloop_patches[i].build;
+        double run_ns = bench_render(build, BENCH_RUN, 0, run, frames, BENCH_CALLBACK_FRAMES);
+        double render_ns = bench_render(build, BENCH_RENDER, 0, render, frames, BENCH_CALLBACK_FRAMES);
+        double plan_ns = bench_render(build, BENCH_PLAN, 1, plan, frames, BENCH_CALLBACK_FRAMES);
+        bench_render(build, BENCH_PLAN, 1, small, frames, BENCH_SMALL_FRAMES);
+        int identical = memcmp(run, render, sizeof(float) * frames) == 0 &&
+                memcmp(run, plan, sizeof(float) * frames) == 0 &&
+                memcmp(run, small, sizeof(float) * frames) == 0;
+        printf("%-26s %14.2f %14.2f %14.2f %8.2fx %10s\n", bloop_patches[i].name, run_ns, render_ns, plan_ns, run_ns / plan_ns, identical ? "yes" : "NO");
+    }
+    bloop_sample_close(bench_sample_file);
+    return 0;
+}
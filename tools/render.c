@@ -0,0 +1,188 @@
+#define SOKOL_IMPL
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "sokol_args.h"
+#include "bloop.h"
+#include "patches.h"
+#include "patchfile.h"
+#include "stereo.h"
+#include "sample.h"
+#include "convolution.h"
+#include "plan.h"
+#include "pool.h"
+
+/*
+ * Renders a patch as fast as possible, either to a WAV file or as raw PCM on
+ * stdout, e.g.
+ *
+ *     render patch=kick_rumble_wobble seconds=30 out=kick.wav
+ *     render patch=velocity_kick_sequence ticks=88200 out=- format=f32 | aplay ...
+ *     render patch=kick_rumble_wobble save=wobble.bloop out=/dev/null ticks=0
+ *     render file=wobble.bloop out=wobble.wav
+ *
+ * Arguments:
+ *     patch=NAME      the patch to render (list=true shows all patches)
+ *     file=PATH       render a patch file instead (see patchfile.h)
+ *     save=PATH       also save the patch to a patch file
+ *     pan=P           render in stereo, with the patch panned to P (-1 to 1)
+ *     reverb=PATH     convolve the patch with the impulse response in a WAV
+ *                     file, e.g. of a room
+ *     mix=M           how much of the reverb to mix in (0 to 1, default 0.3)
+ *     seconds=N       how many seconds to render (default 10)
+ *     ticks=N         how many samples to render, overrides seconds
+ *     out=PATH        the WAV file to write, or - for raw PCM on stdout
+ *     format=s16|f32  16 bit signed integer or 32 bit float samples
+ *     block=N         frames per render call (default 2048)
+ *     threads=N       worker threads next to the main thread (default 0)
+ *     seed=N          seed for the noise generators (default 0)
+ */
+
+#define RENDER_DEFAULT_BLOCK 2048
+
+extern int SAMPLE_RATE;
+
+static void write_u16(FILE *f, uint16_t v) {
+    uint8_t b[2] = { v & 0xff, v >> 8 };
+    fwrite(b, 1, 2, f);
+}
+
+static void write_u32(FILE *f, uint32_t v) {
+    uint8_t b[4] = { v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24 };
+    fwrite(b, 1, 4, f);
+}
+
+static void write_wav_header(FILE *f, int frames, int channels, int is_float) {
+    int bytes_per_sample = is_float ? 4 : 2;
+    uint32_t data_size = (uint32_t)frames * channels * bytes_per_sample;
+    fwrite("RIFF", 1, 4, f);
+    write_u32(f, 36 + data_size);
+    fwrite("WAVE", 1, 4, f);
+    fwrite("fmt ", 1, 4, f);
+    write_u32(f, 16);
+    write_u16(f, is_float ? 3 : 1);
+    write_u16(f, channels);
+    write_u32(f, SAMPLE_RATE);
+    write_u32(f, SAMPLE_RATE * channels * bytes_per_sample);
+    write_u16(f, channels * bytes_per_sample);
+    write_u16(f, bytes_per_sample * 8);
+    fwrite("data", 1, 4, f);
+    write_u32(f, data_size);
+}
+
+static void write_samples(FILE *f, float *samples, int16_t *pcm, int n, int is_float) {
+    if (is_float) {
+        fwrite(samples, sizeof(float), n, f);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        float s = samples[i];
+        s = s > 1.0f ? 1.0f : (s < -1.0f ? -1.0f : s);
+        pcm[i] = (int16_t)(s * 32767.0f);
+    }
+    fwrite(pcm, sizeof(int16_t), n, f);
+}
+
+int main(int argc, char **argv) {
+    sargs_setup(&(sargs_desc){
+        .argc = argc,
+        .argv = argv
+    });
+
+    if (sargs_boolean("list")) {
+        for (int i = 0; i < bloop_patch_count; i++) {
+            printf("%s\n", bloop_patches[i].name);
+        }
+        return 0;
+    }
+
+    const char *name = sargs_value_def("patch", "velocity_kick_sequence");
+    bloop_patch *patch = bloop_find_patch(name);
+    if (patch == NULL && !sargs_exists("file")) {
+        fprintf(stderr, "unknown patch: %s (list=true shows all patches)\n", name);
+        return 1;
+    }
+    if (!sargs_exists("out")) {
+        fprintf(stderr, "usage: render patch=NAME|file=PATH [save=PATH] [pan=P] [reverb=PATH [mix=M]] [seconds=N|ticks=N] out=PATH|- [format=s16|f32] [block=N] [threads=N] [seed=N]\n");
+        return 1;
+    }
+
+    int frames = (int)(atof(sargs_value_def("seconds", "10")) * SAMPLE_RATE);
+    if (sargs_exists("ticks")) {
+        frames = atoi(sargs_value("ticks"));
+    }
+    int block = atoi(sargs_value_def("block", "2048"));
+    if (block <= 0) {
+        block = RENDER_DEFAULT_BLOCK;
+    }
+    int is_float = sargs_equals("format", "f32");
+    int raw = sargs_equals("out", "-");
+    int channels = sargs_exists("pan") ? 2 : 1;
+
+    FILE *f = raw ? stdout : fopen(sargs_value("out"), "wb");
+    if (f == NULL) {
+        fprintf(stderr, "could not open %s\n", sargs_value("out"));
+        return 1;
+    }
+    if (!raw) {
+        write_wav_header(f, frames, channels, is_float);
+    }
+
+    bloop_random_seed_global((uint32_t)strtoul(sargs_value_def("seed", "0"), NULL, 10));
+    bloop_generator *g;
+    if (sargs_exists("file")) {
+        bloop_patch_file *pf = bloop_patch_file_open(sargs_value("file"));
+        g = pf == NULL ? NULL : bloop_patch_file_instantiate(pf);
+        if (g == NULL) {
+            fprintf(stderr, "could not load %s\n", sargs_value("file"));
+            return 1;
+        }
+        bloop_patch_file_close(pf);
+    } else {
+        g = patch->build();
+    }
+    if (sargs_exists("save") && bloop_patch_file_save(g, sargs_value("save")) != 0) {
+        fprintf(stderr, "could not save %s\n", sargs_value("save"));
+        return 1;
+    }
+    if (sargs_exists("reverb")) {
+        bloop_sample_file *ir = bloop_sample_open(sargs_value("reverb"));
+        if (ir == NULL) {
+            fprintf(stderr, "could not load %s\n", sargs_value("reverb"));
+            return 1;
+        }
+        g = bloop_convolution_file(g, ir, bloop_constant(atof(sargs_value_def("mix", "0.3"))));
+        bloop_sample_close(ir);
+    }
+    bloop_generator *roots[2] = { g, g };
+    if (channels == 2) {
+        bloop_stereo s = bloop_pan(g, bloop_constant(atof(sargs_value("pan"))));
+        roots[0] = s.left;
+        roots[1] = s.right;
+    }
+    for (int c = 0; c < channels; c++) {
+        bloop_optimize(roots[c]);
+    }
+    bloop_plan *plan = bloop_plan_compile_channels(channels, roots);
+    bloop_pool_start(atoi(sargs_value_def("threads", "0")));
+    bloop_convolution_start();
+    bloop_sample_prefetch_start();
+    float *samples = malloc(sizeof(float) * block * channels);
+    int16_t *pcm = malloc(sizeof(int16_t) * block * channels);
+    for (bloop_tick tick = 0; tick < frames; tick += block) {
+        int n = frames - tick < block ? frames - tick : block;
+        bloop_plan_run_interleaved(plan, samples, n, channels, tick);
+        write_samples(f, samples, pcm, n * channels, is_float);
+    }
+
+    if (!raw) {
+        fclose(f);
+    }
+    bloop_pool_stop();
+    bloop_convolution_stop();
+    bloop_sample_prefetch_stop();
+    bloop_plan_free(plan);
+    sargs_shutdown();
+    return 0;
+}
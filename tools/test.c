@@ -0,0 +1,261 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "bloop.h"
+#include "patches.h"
+#include "patchfile.h"
+#include "stereo.h"
+#include "convolution.h"
+#include "sample.h"
+#include "plan.h"
+#include "arena.h"
+
+/*
+ * Checks of the engine that the benchmark doesn't time, e.g.
+ *
+ *     make test
+ *
+ * - blocks: every patch rendered with bloop_run and with plans at two block
+ *   sizes has to produce exactly the same samples, so nothing depends on
+ *   the size of the audio callback.
+ * - threads: with the tail thread of the convolutions running, every patch
+ *   has to render the same samples as without it, also after a patch with
+ *   a reverb was freed.
+ * - samples: raw files of an unknown format are rejected, and players can
+ *   be freed and their file closed while the prefetch thread runs.
+ * - layout: the node editor's layout of every patch has to put every node
+ *   between the first column and the root's.
+ * - files: patch files that are damaged in ways that would crash or hang a
+ *   constructor have to be rejected by bloop_patch_file_instantiate.
+ *
+ * Prints every check and exits with 1 if any of them failed.
+ */
+
+#define TEST_SECONDS 5
+
+extern int SAMPLE_RATE;
+
+static int failures = 0;
+
+static void check(int ok, const char *what, const char *name) {
+    printf("%-8s %-26s %s\n", what, name, ok ? "ok" : "FAILED");
+    failures += !ok;
+}
+
+// Renders frames samples of a freshly built patch, block frames per call,
+// with bloop_run when block is 0 and with an optimized plan otherwise.
+static void test_render(bloop_generator *(*build)(), float *out, int frames, int block) {
+    bloop_arena *arena = bloop_arena_new(BLOOP_ARENA_CHUNK_SIZE);
+    bloop_arena_use(arena);
+    bloop_random_seed_global(0);
+    bloop_generator *g = build();
+    if (block == 0) {
+        bloop_arena_use(NULL);
+        for (bloop_tick tick = 0; tick < frames; tick++) {
+            out[tick] = bloop_run(g, tick);
+        }
+    } else {
+        bloop_optimize(g);
+        bloop_arena_use(NULL);
+        bloop_plan *plan = bloop_plan_compile(g);
+        for (bloop_tick tick = 0; tick < frames; tick += block) {
+            int n = frames - tick < block ? frames - tick : block;
+            bloop_plan_run(plan, out + tick, n, tick);
+        }
+        bloop_plan_free(plan);
+    }
+    bloop_free_graph(g);
+    bloop_arena_free(arena);
+}
+
+static void test_blocks(void) {
+    int frames = TEST_SECONDS * SAMPLE_RATE;
+    float *run = malloc(sizeof(float) * frames);
+    float *small = malloc(sizeof(float) * frames);
+    float *large = malloc(sizeof(float) * frames);
+    for (int i = 0; i < bloop_patch_count; i++) {
+        test_render(bloop_patches[i].build, run, frames, 0);
+        test_render(bloop_patches[i].build, small, frames, 64);
+        test_render(bloop_patches[i].build, large, frames, BLOOP_MAX_BLOCK * 8);
+        int ok = memcmp(run, small, sizeof(float) * frames) == 0 && memcmp(run, large, sizeof(float) * frames) == 0;
+        check(ok, "blocks", bloop_patches[i].name);
+    }
+    free(run);
+    free(small);
+    free(large);
+}
+
+static void test_threads(void) {
+    int frames = TEST_SECONDS * SAMPLE_RATE;
+    float *run = malloc(sizeof(float) * frames);
+    float *threaded = malloc(sizeof(float) * frames);
+    bloop_arena *arena = bloop_arena_new(BLOOP_ARENA_CHUNK_SIZE);
+    bloop_arena_use(arena);
+    bloop_find_patch("room_reverb")->build();
+    bloop_arena_use(NULL);
+    // Without bloop_free_graph, so the arena has to take it off the thread.
+    bloop_arena_free(arena);
+    bloop_convolution_start();
+    for (int i = 0; i < bloop_patch_count; i++) {
+        test_render(bloop_patches[i].build, run, frames, 0);
+        test_render(bloop_patches[i].build, threaded, frames, 64);
+        check(memcmp(run, threaded, sizeof(float) * frames) == 0, "threads", bloop_patches[i].name);
+    }
+    bloop_convolution_stop();
+    free(run);
+    free(threaded);
+}
+
+static void test_samples(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/bloop_test_%d.raw", (int) getpid());
+    FILE *f = fopen(path, "wb");
+    for (int i = 0; i < SAMPLE_RATE; i++) {
+        float s = (float) i / SAMPLE_RATE;
+        fwrite(&s, sizeof(s), 1, f);
+    }
+    fclose(f);
+    check(bloop_sample_open_raw(path, (enum bloop_sample_format) 3, 1, SAMPLE_RATE) == NULL, "samples", "unknown format");
+
+    bloop_sample_file *file = bloop_sample_open_raw(path, BLOOP_SAMPLE_F32, 1, SAMPLE_RATE);
+    bloop_sample_prefetch_start();
+    int ok = file != NULL;
+    for (int closed = 0; ok && closed < 2; closed++) {
+        bloop_arena *arena = bloop_arena_new(BLOOP_ARENA_CHUNK_SIZE);
+        bloop_arena_use(arena);
+        bloop_generator *g = bloop_sample(file, C(1.0), C(1.0));
+        bloop_arena_use(NULL);
+        for (bloop_tick tick = 0; tick < SAMPLE_RATE; tick++) {
+            ok = ok && bloop_run(g, tick) == (float) tick / SAMPLE_RATE;
+        }
+        if (closed) {
+            bloop_sample_close(file);
+            usleep(BLOOP_SAMPLE_PREFETCH_INTERVAL * 4);
+        }
+        bloop_arena_free(arena);
+        usleep(BLOOP_SAMPLE_PREFETCH_INTERVAL * 4);
+    }
+    bloop_sample_prefetch_stop();
+    unlink(path);
+    check(ok, "samples", "prefetch");
+}
+
+// Whether the layout put g and everything below it in a column left of
+// the root's.
+static int test_columns(bloop_generator *g, int columns) {
+    int ok = g->meta->x >= 0 && g->meta->x <= columns;
+    for (int i = 0; i < g->input_count; i++) {
+        if (g->inputs[i] != NULL) {
+            ok = test_columns(g->inputs[i], columns) && ok;
+        }
+    }
+    return ok;
+}
+
+static void test_layout(void) {
+    for (int i = 0; i < bloop_patch_count; i++) {
+        bloop_arena *arena = bloop_arena_new(BLOOP_ARENA_CHUNK_SIZE);
+        bloop_arena_use(arena);
+        bloop_generator *g = bloop_patches[i].build();
+        bloop_arena_use(NULL);
+        bloop_calculate_layout(g);
+        check(test_columns(g, g->meta->x), "layout", bloop_patches[i].name);
+        bloop_free_graph(g);
+        bloop_arena_free(arena);
+    }
+}
+
+// Damages a patch file in place: missing sets every input to -1, and
+// otherwise parameter which of every node of type is set to value, or its
+// input count for TEST_INPUT_COUNT.
+#define TEST_INPUT_COUNT UINT32_MAX
+
+static void test_damage(const char *path, int missing, uint32_t type, uint32_t which, int32_t value) {
+    FILE *f = fopen(path, "r+b");
+    bloop_patch_file_header h;
+    if (f == NULL || fread(&h, sizeof(h), 1, f) != 1) {
+        exit(2);
+    }
+    for (uint32_t i = 0; missing && i < h.input_count; i++) {
+        int32_t none = -1;
+        fseek(f, h.inputs + sizeof(int32_t) * i, SEEK_SET);
+        fwrite(&none, sizeof(none), 1, f);
+    }
+    for (uint32_t i = 0; !missing && i < h.node_count; i++) {
+        bloop_patch_file_node node;
+        fseek(f, h.nodes + sizeof(node) * i, SEEK_SET);
+        if (fread(&node, sizeof(node), 1, f) != 1 || node.type != type) {
+            continue;
+        }
+        if (which == TEST_INPUT_COUNT) {
+            node.input_count = value;
+            fseek(f, h.nodes + sizeof(node) * i, SEEK_SET);
+            fwrite(&node, sizeof(node), 1, f);
+        } else if (which < node.value_count) {
+            fseek(f, h.values + sizeof(bloop_patch_file_value) * (node.value_start + which), SEEK_SET);
+            fwrite(&value, sizeof(value), 1, f);
+        }
+    }
+    fclose(f);
+}
+
+// Saves g and checks that it loads, then that it doesn't after test_damage.
+static void test_file(const char *name, bloop_generator *g, int missing, uint32_t type, uint32_t which, int32_t value) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/bloop_test_%d.bloop", (int) getpid());
+    int ok = bloop_patch_file_save(g, path) == 0;
+    for (int damaged = 0; ok && damaged < 2; damaged++) {
+        if (damaged) {
+            test_damage(path, missing, type, which, value);
+        }
+        bloop_patch_file *f = bloop_patch_file_open(path);
+        bloop_arena *arena = bloop_arena_new(BLOOP_ARENA_CHUNK_SIZE);
+        bloop_arena_use(arena);
+        bloop_generator *loaded = f == NULL ? NULL : bloop_patch_file_instantiate(f);
+        bloop_arena_use(NULL);
+        if (loaded != NULL) {
+            bloop_free_graph(loaded);
+        }
+        bloop_arena_free(arena);
+        if (f != NULL) {
+            bloop_patch_file_close(f);
+        }
+        ok = damaged ? loaded == NULL : loaded != NULL;
+    }
+    unlink(path);
+    check(ok, "files", name);
+}
+
+static void test_files(void) {
+    bloop_arena *arena = bloop_arena_new(BLOOP_ARENA_CHUNK_SIZE);
+    bloop_arena_use(arena);
+    bloop_generator *kick = bloop_find_patch("sine_kick_drum")->build();
+    bloop_generator *delay = bloop_delay(C(0.5), C(100.0), C(0.5), C(0.2), 1000);
+    bloop_generator *repeat = bloop_repeat(C(0.5), 1000);
+    bloop_generator *pan = bloop_pan_channel(C(0.5), C(0.0), 0, 2);
+    bloop_generator *average = bloop_average(2, C(0.5), C(0.25));
+    bloop_generator *adsr = bloop_adsr(0.3, 0.0, 150, 150, 0, 0);
+    bloop_generator *interpolation = bloop_interpolation(0.9, 0.2, 100);
+    bloop_arena_use(NULL);
+    test_file("missing inputs", kick, 1, 0, 0, 0);
+    test_file("huge delay", delay, 0, BLOOP_DELAY, 0, INT_MAX);
+    test_file("huge repeat", repeat, 0, BLOOP_REPEAT, 0, INT_MAX);
+    test_file("huge pan", pan, 0, BLOOP_PAN, 1, INT_MAX);
+    test_file("empty average", average, 0, BLOOP_AVERAGE, TEST_INPUT_COUNT, 0);
+    test_file("no attack", adsr, 0, BLOOP_ADSR, 2, 0);
+    test_file("huge release", adsr, 0, BLOOP_ADSR, 5, INT_MAX);
+    test_file("no interpolation", interpolation, 0, BLOOP_INTERPOLATION, 2, 0);
+    bloop_arena_free(arena);
+}
+
+int main(int argc, char **argv) {
+    test_blocks();
+    test_threads();
+    test_samples();
+    test_layout();
+    test_files();
+    printf("\n%d failed\n", failures);
+    return failures > 0;
+}